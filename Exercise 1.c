@@ -191,3 +191,95 @@ __attribute__((interrupt(USCIAB0RX_VECTOR))) void rx_isr(void)
         ring_buffer_put(_rbd, &c);
     }
 }
+
+
+//Handing whole frames to the application
+
+/* The ISR above still puts one byte at a time and the application gets them back one call at a time.
+ With a small pool of frame buffers the ISR can hand over complete frames instead.
+ The free frames are kept as indices in a second ring buffer: the application puts an index back when it is done with a frame
+ and the ISR gets one when a new frame starts. The received frames travel as indices in a third ring buffer.
+ Every ring still has exactly one writer of head and one writer of tail, so no critical section is needed,
+ and taking a frame in the ISR is a single ring_buffer_get which never waits.
+ This is the same scheme as k2lib::IsrPool in Exercise 2, which does the same for C++ code and Linux signal handlers.
+ RING_BUFFER_MAX must be at least 3 for this.*/
+
+#define FRAME_SIZE  32
+#define FRAME_COUNT 4
+
+struct frame {
+    uint8_t len;
+    char data[FRAME_SIZE];
+};
+
+static struct frame _frames[FRAME_COUNT];
+static rbd_t _free_rbd;             // indices of free frames, put by the application, got by the ISR
+static rbd_t _rx_rbd;               // indices of received frames, put by the ISR, got by the application
+static uint8_t _free_rbmem[FRAME_COUNT];
+static uint8_t _rx_rbmem[FRAME_COUNT];
+static uint8_t _cur = FRAME_COUNT;  // frame the ISR is filling, FRAME_COUNT when there is none
+
+int uart_frames_init(void)
+{
+    rb_attr_t free_attr = {sizeof(_free_rbmem[0]), ARRAY_SIZE(_free_rbmem), _free_rbmem};
+    rb_attr_t rx_attr = {sizeof(_rx_rbmem[0]), ARRAY_SIZE(_rx_rbmem), _rx_rbmem};
+    uint8_t i;
+
+    if ((ring_buffer_init(&_free_rbd, &free_attr) != 0) || (ring_buffer_init(&_rx_rbd, &rx_attr) != 0)) {
+        return -1;
+    }
+
+    /* All frames start out free */
+    for (i = 0; i < FRAME_COUNT; i++) {
+        ring_buffer_put(_free_rbd, &i);
+    }
+
+    return 0;
+}
+
+/* The application takes a complete frame, or NULL if none has been received, and gives it back when done. */
+
+struct frame *uart_getframe(void)
+{
+    uint8_t i;
+
+    if (ring_buffer_get(_rx_rbd, &i) != 0) {
+        return NULL;
+    }
+
+    return &_frames[i];
+}
+
+void uart_putframe(struct frame *f)
+{
+    const uint8_t i = f - _frames;
+
+    ring_buffer_put(_free_rbd, &i);
+}
+
+/* The receive ISR collects bytes into the current frame and passes the frame on at the end of a line or when it is full.
+ If the application holds on to all frames, incoming bytes are dropped until one is given back.
+ It replaces the byte ISR rx_isr above: a vector has only one handler, so build one of the two, not both. */
+
+__attribute__((interrupt(USCIAB0RX_VECTOR))) void rx_frame_isr(void)
+{
+    if (IFG2 & UCA0RXIFG) {
+        const char c = UCA0RXBUF;
+
+        /* Clear the interrupt flag */
+        IFG2 &= ~UCA0RXIFG;
+
+        if ((_cur == FRAME_COUNT) && (ring_buffer_get(_free_rbd, &_cur) == 0)) {
+            _frames[_cur].len = 0;
+        }
+
+        if (_cur != FRAME_COUNT) {
+            _frames[_cur].data[_frames[_cur].len++] = c;
+
+            if ((c == '\n') || (_frames[_cur].len == FRAME_SIZE)) {
+                ring_buffer_put(_rx_rbd, &_cur);
+                _cur = FRAME_COUNT;
+            }
+        }
+    }
+}
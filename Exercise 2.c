@@ -14,14 +14,16 @@ Each element has the same byte size. The application can take (allocate) element
 {
 // namespace k2lib body
 
-template <typename T, int SIZE>
+template <typename T, size_t SIZE, typename RECYCLE = PoolKeep, size_t ALIGN = 0, bool SPREAD = false>
 class Pool
 {
 public:
+  typedef typename PoolIndex<SIZE>::type index_type; /*!< Narrowest type holding a slot index. */
+
   Pool();
   T *palloc();     /*!< Take (allocate) one element from the Pool. */
   void free(T *p); /*!< Give back (free) element of given argument pointer. */
-  int size();      /*!< Returns count of free Pool elements. */
+  size_t size();   /*!< Returns count of free Pool elements. */
 
 private:
   /* Rest of the elements... */
@@ -29,6 +31,29 @@ private:
 
 } // namespace k2lib
 
+/* SIZE is a size_t, so a Pool is no longer limited to 2^31 elements. Slot indices, the free counter
+ and the bit helpers below use index_type, which PoolIndex picks at compile time from SIZE:
+ uint8_t for up to 255 elements, uint16_t up to 65535, uint32_t and then uint64_t.
+ A Pool of 100 elements therefore keeps its counter and every handle in a single byte.*/
+
+/* The elements are constructed once, together with the Pool, and free does not destroy them.
+ For types which are expensive to construct (buffers with inner vectors, parser states) this is what we want:
+ with RECYCLE = PoolRecycle, palloc calls the cheap T::reset() of the element before handing it out,
+ so the memory held by the element is reused by its next user instead of going back to the heap.
+ The default PoolKeep hands elements out as they were given back.*/
+
+/* For replaying simulations, snapshot saves the complete Pool state (info, free_elements_cnt and the used
+ elements) into a Snapshot and restore brings it back, both with a few large memcpy calls.
+ With POOL_TRACK_DIRTY defined, the Pool also keeps one dirty bit per page of elements. palloc and free set it,
+ and the application calls touch after writing to an element. restore then copies back only the dirty pages,
+ so restoring the same snapshot many times costs only as much as was changed in between.*/
+
+/* Neighbouring elements share cache lines. When they are handed to different threads, every write by one thread
+ invalidates the line in the caches of the others (false sharing). ALIGN = 64 or 128 aligns every element to
+ its own cache line and pads it to a whole number of lines. SPREAD = true keeps the dense layout but hands out
+ the first element of every cache line before the second one of any, so consecutive allocations land on different lines.
+ Both default to off and then cost nothing.*/
+
 // Set/clear/test bits in an array.
 
 /* In order to calculate position of the bit given by bit_index argument,
@@ -36,32 +61,32 @@ you have to calculate byte position byte_offset in the info array and bit positi
  Now, you can get &info[0] address and move it by byte_offset. 
  Obtained array element can be set/cleared/tested with the calculated bit_index - 1 << bit_index.*/
 
-void setBit(int bit_index)
+void setBit(index_type bit_index)
 {
   if (bit_index >= SIZE)
     return;
 
-  int byte_offset = (bit_index / BITS_IN_UINT8);
+  index_type byte_offset = (bit_index / BITS_IN_UINT8);
   bit_index = (bit_index % BITS_IN_UINT8);
   *((uint8_t *)(&info[0] + byte_offset)) |= (uint8_t)(1 << bit_index);
 }
 
-void clrBit(int bit_index)
+void clrBit(index_type bit_index)
 {
   if (bit_index >= SIZE)
     return;
 
-  int byte_offset = (bit_index / BITS_IN_UINT8);
+  index_type byte_offset = (bit_index / BITS_IN_UINT8);
   bit_index = (bit_index % BITS_IN_UINT8);
   *((uint8_t *)(&info[0] + byte_offset)) &= ~((uint8_t)(1 << bit_index));
 }
 
-bool testBit(int bit_index)
+bool testBit(index_type bit_index)
 {
   if (bit_index >= SIZE)
     return false;
 
-  int byte_offset = (bit_index / BITS_IN_UINT8);
+  index_type byte_offset = (bit_index / BITS_IN_UINT8);
   bit_index = (bit_index % BITS_IN_UINT8);
   return (0 !=
           (*((uint8_t *)(&info[0] + byte_offset)) & (uint8_t)(1 << bit_index)));
@@ -74,64 +99,206 @@ bool testBit(int bit_index)
 
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
+#include <type_traits>
 
 
 namespace k2lib
 {
 // namespace k2lib body
 
-template <typename T, int SIZE>
-class Pool
+/* Picks the narrowest unsigned type that can hold every slot index of a Pool
+ with SIZE elements, plus the value SIZE itself (used as the free element
+ count and as the "no element" handle). */
+template <size_t SIZE,
+          bool FITS_UINT8 = (SIZE <= 0xFFU),
+          bool FITS_UINT16 = (SIZE <= 0xFFFFU),
+          bool FITS_UINT32 = (SIZE <= 0xFFFFFFFFU)>
+struct PoolIndex
+{
+  typedef uint64_t type;
+};
+
+template <size_t SIZE, bool FITS_UINT16, bool FITS_UINT32>
+struct PoolIndex<SIZE, true, FITS_UINT16, FITS_UINT32>
+{
+  typedef uint8_t type;
+};
+
+template <size_t SIZE, bool FITS_UINT32>
+struct PoolIndex<SIZE, false, true, FITS_UINT32>
+{
+  typedef uint16_t type;
+};
+
+template <size_t SIZE>
+struct PoolIndex<SIZE, false, false, true>
+{
+  typedef uint32_t type;
+};
+
+/* Recycling policies, called by palloc on an element before it is handed out again.
+ The Pool constructs all elements once and never destroys them while it exists,
+ so an element keeps whatever its previous user left in it (including inner allocations). */
+struct PoolKeep
+{
+  template <typename T>
+  static void reset(T &) {} /*!< Element is handed out as it was given back. */
+};
+
+struct PoolRecycle
+{
+  template <typename T>
+  static void reset(T &obj) { obj.reset(); } /*!< T::reset() clears the state but keeps the capacity. */
+};
+
+/* Storage of one element. With ALIGN = 64 or 128 every element starts on its own cache line
+ and is padded to a whole number of lines, so elements used by different threads never share one. */
+template <typename T, size_t ALIGN>
+struct PoolSlot
+{
+  alignas(ALIGN) T object;
+};
+
+template <typename T>
+struct PoolSlot<T, 0>
+{
+  T object; /*!< Natural alignment, no padding. */
+};
+
+/* Position in the spread allocation order; takes no space when SPREAD is off. */
+template <bool SPREAD>
+struct PoolSpreadCursor
+{
+  PoolSpreadCursor() : spread_next(0) {}
+  size_t spreadStart() { return spread_next; }
+  void spreadStop(size_t next) { spread_next = next; }
+
+  size_t spread_next; /*!< Where the next spread search begins. */
+};
+
+template <>
+struct PoolSpreadCursor<false>
+{
+  size_t spreadStart() { return 0; }
+  void spreadStop(size_t) {}
+};
+
+template <typename T, size_t SIZE, typename RECYCLE = PoolKeep, size_t ALIGN = 0, bool SPREAD = false>
+class Pool : private PoolSpreadCursor<SPREAD>
 {
 public:
+  typedef typename PoolIndex<SIZE>::type index_type; /*!< Narrowest type holding a slot index. */
+
+  static const index_type NO_INDEX = SIZE; /*!< Handle which refers to no element. */
+
   Pool();
   T *palloc();     /*!< Take (allocate) one element from the Pool. */
   void free(T *p); /*!< Give back (free) element of given argument pointer. */
-  int size();      /*!< Returns count of free Pool elements. */
+  size_t size();   /*!< Returns count of free Pool elements. */
+
+  index_type index_of(const T *p); /*!< Returns handle of element, NO_INDEX if p is not from this Pool. */
+  T *at(index_type index);         /*!< Returns element of given handle, NULL if out of range. */
+
+  struct Snapshot;
+  void snapshot(Snapshot &s);      /*!< Copy the Pool state into s, T must be trivially copyable. */
+  void restore(const Snapshot &s); /*!< Bring the Pool back to the state saved in s. */
+#ifdef POOL_TRACK_DIRTY
+  void touch(const T *p);          /*!< Mark element as modified since the last snapshot or restore. */
+#endif
 
 private:
-  T elements[SIZE]; /*!< Holds the pool objects. */
+  typedef PoolSlot<T, ALIGN> Slot;
+
+  static_assert(0 == (ALIGN & (ALIGN - 1)), "Pool alignment must be a power of 2");
+
+  Slot elements[SIZE]; /*!< Holds the pool objects. */
+
+  static const size_t CACHE_LINE = 64;
+  static const size_t PER_LINE =
+      (sizeof(Slot) >= CACHE_LINE) ? 1 : CACHE_LINE / sizeof(Slot); /*!< Elements sharing a cache line. */
+  static const size_t LINES = (SIZE + PER_LINE - 1) / PER_LINE;     /*!< Cache lines spanned by elements. */
 
   static const size_t BITS_IN_UINT8 = 8; /*!< Number of bits in uint8_t type. */
   static const size_t NO_BYTES =
       (SIZE + BITS_IN_UINT8 - 1) /
-      BITS_IN_UINT8;      /*!< Required number of bytes to hold information
-                          about free/allocated pool objects. */
-  uint8_t info[NO_BYTES]; /*!< Keeps track of free/allocated memory objects. */
-  int free_elements_cnt;  /*!< Counts number of free elements */
+      BITS_IN_UINT8;             /*!< Required number of bytes to hold information
+                                 about free/allocated pool objects. */
+  uint8_t info[NO_BYTES];        /*!< Keeps track of free/allocated memory objects. */
+  index_type free_elements_cnt;  /*!< Counts number of free elements */
+
+#ifdef POOL_TRACK_DIRTY
+  static const size_t DIRTY_BLOCK =
+      (sizeof(Slot) >= 4096) ? 1 : 4096 / sizeof(Slot); /*!< Elements per dirty bit, about one page. */
+  static const size_t DIRTY_BLOCKS = (SIZE + DIRTY_BLOCK - 1) / DIRTY_BLOCK;
+  uint8_t dirty[(DIRTY_BLOCKS + BITS_IN_UINT8 - 1) / BITS_IN_UINT8]; /*!< Blocks modified since last snapshot/restore. */
+  const Snapshot *dirty_base;                                       /*!< Snapshot the dirty bits refer to. */
+
+  void markDirty(size_t index);
+#endif
+
+  T *take(index_type index);
+  T *spreadAlloc();
+
+  bool testBit(index_type bit_index);
+  void setBit(index_type bit_index);
+  void clrBit(index_type bit_index);
+};
 
-  bool testBit(int bit_index);
-  void setBit(int bit_index);
-  void clrBit(int bit_index);
+/* A saved Pool state. It holds a full elements array, so it is as large as the Pool and
+ usually lives in static or heap memory. Only elements between first and last were in use
+ when it was taken, the rest of its elements array is never read. */
+template <typename T, size_t SIZE, typename RECYCLE, size_t ALIGN, bool SPREAD>
+struct Pool<T, SIZE, RECYCLE, ALIGN, SPREAD>::Snapshot
+{
+  Slot elements[SIZE];
+  uint8_t info[NO_BYTES];
+  index_type free_elements_cnt;
+  size_t first; /*!< First element in use. */
+  size_t last;  /*!< One past the last element in use. */
 };
 
+template <typename T, size_t SIZE, typename RECYCLE, size_t ALIGN, bool SPREAD>
+const typename Pool<T, SIZE, RECYCLE, ALIGN, SPREAD>::index_type Pool<T, SIZE, RECYCLE, ALIGN, SPREAD>::NO_INDEX;
 
-template <typename T, int SIZE>
-Pool<T, SIZE>::Pool()
+template <typename T, size_t SIZE, typename RECYCLE, size_t ALIGN, bool SPREAD>
+Pool<T, SIZE, RECYCLE, ALIGN, SPREAD>::Pool()
 {
   // Free all pool objects
-  for (unsigned int i = 0; i < NO_BYTES; i++)
+  for (size_t i = 0; i < NO_BYTES; i++)
     info[i] = 0xFFU;
   // Clera
   free_elements_cnt = SIZE;
+#ifdef POOL_TRACK_DIRTY
+  memset(dirty, 0xFF, sizeof(dirty));
+  dirty_base = NULL;
+#endif
 }
 
-template <typename T, int SIZE>
-T *Pool<T, SIZE>::palloc()
+template <typename T, size_t SIZE, typename RECYCLE, size_t ALIGN, bool SPREAD>
+T *Pool<T, SIZE, RECYCLE, ALIGN, SPREAD>::palloc()
 {
   // Test whether there are any free elements
-  if (free_elements_cnt <= 0)
+  if (free_elements_cnt == 0)
     return NULL;
 
-  // Look up for first pool object
-  for (int i = 0; i < SIZE; i++)
+  if (SPREAD && PER_LINE > 1)
+    return spreadAlloc();
+
+  // Look up for first pool object, skipping bytes of info whose elements are all allocated
+  for (size_t byte = 0; byte < NO_BYTES; byte++)
   {
-    if (testBit(i))
+    if (0 == info[byte])
+      continue;
+
+    for (size_t bit = 0; bit < BITS_IN_UINT8; bit++)
     {
-      // Found free element, so mark it as allocated and return
-      clrBit(i);
-      free_elements_cnt--;
-      return &elements[i];
+      const index_type i = (index_type)(byte * BITS_IN_UINT8 + bit);
+      if (testBit(i))
+      {
+        // Found free element
+        return take(i);
+      }
     }
   }
 
@@ -139,65 +306,222 @@ T *Pool<T, SIZE>::palloc()
   return NULL;
 }
 
-template <typename T, int SIZE>
-void Pool<T, SIZE>::free(T *p)
+template <typename T, size_t SIZE, typename RECYCLE, size_t ALIGN, bool SPREAD>
+void Pool<T, SIZE, RECYCLE, ALIGN, SPREAD>::free(T *p)
 {
   // Cannot free NULL pointer
   if (NULL == p)
     return;
 
-  // Loop through all elements and find the one to be freed
-  for (int i = 0; i < SIZE; i++)
+  // The element index follows from its address, no need to search for it
+  index_type i = index_of(p);
+
+  // Element not from this Pool or already free, memory cannot be freed
+  if (NO_INDEX == i || testBit(i))
+    return;
+
+  setBit(i);
+  free_elements_cnt++;
+#ifdef POOL_TRACK_DIRTY
+  markDirty(i);
+#endif
+}
+
+template <typename T, size_t SIZE, typename RECYCLE, size_t ALIGN, bool SPREAD>
+size_t Pool<T, SIZE, RECYCLE, ALIGN, SPREAD>::size()
+{
+  return free_elements_cnt;
+}
+
+template <typename T, size_t SIZE, typename RECYCLE, size_t ALIGN, bool SPREAD>
+typename Pool<T, SIZE, RECYCLE, ALIGN, SPREAD>::index_type Pool<T, SIZE, RECYCLE, ALIGN, SPREAD>::index_of(const T *p)
+{
+  // Object is the first member of its slot, so it has to start exactly at a slot boundary
+  const size_t offset = (size_t)((const uint8_t *)p - (const uint8_t *)&elements[0]);
+  if (p < &elements[0].object || offset >= sizeof(elements) || 0 != offset % sizeof(Slot))
+    return NO_INDEX;
+
+  return (index_type)(offset / sizeof(Slot));
+}
+
+template <typename T, size_t SIZE, typename RECYCLE, size_t ALIGN, bool SPREAD>
+T *Pool<T, SIZE, RECYCLE, ALIGN, SPREAD>::at(index_type index)
+{
+  if (index >= SIZE)
+    return NULL;
+
+  return &elements[index].object;
+}
+
+template <typename T, size_t SIZE, typename RECYCLE, size_t ALIGN, bool SPREAD>
+T *Pool<T, SIZE, RECYCLE, ALIGN, SPREAD>::take(index_type index)
+{
+  // Mark element as allocated and return it in a clean state
+  clrBit(index);
+  free_elements_cnt--;
+  RECYCLE::reset(elements[index].object);
+#ifdef POOL_TRACK_DIRTY
+  markDirty(index);
+#endif
+  return &elements[index].object;
+}
+
+/* Spread order visits the first element of every cache line, then the second one of every line, and so on:
+ position j maps to element (j % LINES) * PER_LINE + j / LINES. Consecutive allocations therefore land
+ on different cache lines as long as there are free lines. The search continues where the previous one stopped. */
+template <typename T, size_t SIZE, typename RECYCLE, size_t ALIGN, bool SPREAD>
+T *Pool<T, SIZE, RECYCLE, ALIGN, SPREAD>::spreadAlloc()
+{
+  const size_t positions = LINES * PER_LINE;
+  size_t j = this->spreadStart();
+
+  for (size_t n = 0; n < positions; n++)
+  {
+    const size_t i = (j % LINES) * PER_LINE + j / LINES;
+    if (++j == positions)
+      j = 0;
+
+    // The last line may be only partly covered by elements
+    if (i < SIZE && testBit((index_type)i))
+    {
+      this->spreadStop(j);
+      return take((index_type)i);
+    }
+  }
+
+  // No free elements available
+  return NULL;
+}
+
+/* Used elements are copied as one block from the first to the last one in use:
+ a single large memcpy runs close to memory bandwidth, while copying element by element would not. */
+template <typename T, size_t SIZE, typename RECYCLE, size_t ALIGN, bool SPREAD>
+void Pool<T, SIZE, RECYCLE, ALIGN, SPREAD>::snapshot(Snapshot &s)
+{
+  static_assert(std::is_trivially_copyable<T>::value, "Pool snapshots need a trivially copyable T");
+
+  // Find the range of used elements, a zero bit is an allocated element
+  s.first = SIZE;
+  s.last = 0;
+  for (size_t byte = 0; byte < NO_BYTES; byte++)
+  {
+    if (0xFFU == info[byte])
+      continue;
+    for (size_t bit = 0; bit < BITS_IN_UINT8; bit++)
+    {
+      const size_t i = byte * BITS_IN_UINT8 + bit;
+      if (i < SIZE && !testBit((index_type)i))
+      {
+        if (s.first == SIZE)
+          s.first = i;
+        s.last = i + 1;
+      }
+    }
+  }
+
+  memcpy(s.info, info, sizeof(info));
+  s.free_elements_cnt = free_elements_cnt;
+  if (s.first < s.last)
+    memcpy(&s.elements[s.first], &elements[s.first], (s.last - s.first) * sizeof(Slot));
+
+#ifdef POOL_TRACK_DIRTY
+  memset(dirty, 0, sizeof(dirty));
+  dirty_base = &s;
+#endif
+}
+
+template <typename T, size_t SIZE, typename RECYCLE, size_t ALIGN, bool SPREAD>
+void Pool<T, SIZE, RECYCLE, ALIGN, SPREAD>::restore(const Snapshot &s)
+{
+  memcpy(info, s.info, sizeof(info));
+  free_elements_cnt = s.free_elements_cnt;
+  if (s.first >= s.last)
+    return;
+
+#ifdef POOL_TRACK_DIRTY
+  // Dirty bits only describe changes against the snapshot taken or restored last
+  if (dirty_base == &s)
   {
-    if (p == &elements[i])
+    // Copy back runs of dirty blocks which overlap the used range of the snapshot
+    size_t b = s.first / DIRTY_BLOCK;
+    const size_t end = (s.last + DIRTY_BLOCK - 1) / DIRTY_BLOCK;
+    while (b < end)
     {
-      // Element found, so free this element
-      p = NULL;
-      setBit(i);
-      free_elements_cnt++;
+      if (0 == (dirty[b / BITS_IN_UINT8] & (uint8_t)(1 << (b % BITS_IN_UINT8))))
+      {
+        b++;
+        continue;
+      }
+      size_t run = b;
+      while (run < end && 0 != (dirty[run / BITS_IN_UINT8] & (uint8_t)(1 << (run % BITS_IN_UINT8))))
+        run++;
+
+      size_t from = b * DIRTY_BLOCK, to = run * DIRTY_BLOCK;
+      if (from < s.first)
+        from = s.first;
+      if (to > s.last)
+        to = s.last;
+      memcpy(&elements[from], &s.elements[from], (to - from) * sizeof(Slot));
+      b = run;
     }
+    memset(dirty, 0, sizeof(dirty));
+    return;
   }
+  memset(dirty, 0, sizeof(dirty));
+  dirty_base = &s;
+#endif
 
-  // No elements found, memory cannot be freed
-  return;
+  memcpy(&elements[s.first], &s.elements[s.first], (s.last - s.first) * sizeof(Slot));
 }
 
-template <typename T, int SIZE>
-int Pool<T, SIZE>::size()
+#ifdef POOL_TRACK_DIRTY
+template <typename T, size_t SIZE, typename RECYCLE, size_t ALIGN, bool SPREAD>
+void Pool<T, SIZE, RECYCLE, ALIGN, SPREAD>::touch(const T *p)
 {
-  return free_elements_cnt;
+  const index_type i = index_of(p);
+
+  if (NO_INDEX != i)
+    markDirty(i);
+}
+
+template <typename T, size_t SIZE, typename RECYCLE, size_t ALIGN, bool SPREAD>
+void Pool<T, SIZE, RECYCLE, ALIGN, SPREAD>::markDirty(size_t index)
+{
+  const size_t b = index / DIRTY_BLOCK;
+  dirty[b / BITS_IN_UINT8] |= (uint8_t)(1 << (b % BITS_IN_UINT8));
 }
+#endif
 
-template <typename T, int SIZE>
-bool Pool<T, SIZE>::testBit(int bit_index)
+template <typename T, size_t SIZE, typename RECYCLE, size_t ALIGN, bool SPREAD>
+bool Pool<T, SIZE, RECYCLE, ALIGN, SPREAD>::testBit(index_type bit_index)
 {
   if (bit_index >= SIZE)
     return false;
 
-  int byte_offset = (bit_index / BITS_IN_UINT8);
+  index_type byte_offset = (bit_index / BITS_IN_UINT8);
   bit_index = (bit_index % BITS_IN_UINT8);
   return (0 !=
           (*((uint8_t *)(&info[0] + byte_offset)) & (uint8_t)(1 << bit_index)));
 }
 
-template <typename T, int SIZE>
-void Pool<T, SIZE>::setBit(int bit_index)
+template <typename T, size_t SIZE, typename RECYCLE, size_t ALIGN, bool SPREAD>
+void Pool<T, SIZE, RECYCLE, ALIGN, SPREAD>::setBit(index_type bit_index)
 {
   if (bit_index >= SIZE)
     return;
 
-  int byte_offset = (bit_index / BITS_IN_UINT8);
+  index_type byte_offset = (bit_index / BITS_IN_UINT8);
   bit_index = (bit_index % BITS_IN_UINT8);
   *((uint8_t *)(&info[0] + byte_offset)) |= (uint8_t)(1 << bit_index);
 }
 
-template <typename T, int SIZE>
-void Pool<T, SIZE>::clrBit(int bit_index)
+template <typename T, size_t SIZE, typename RECYCLE, size_t ALIGN, bool SPREAD>
+void Pool<T, SIZE, RECYCLE, ALIGN, SPREAD>::clrBit(index_type bit_index)
 {
   if (bit_index >= SIZE)
     return;
 
-  int byte_offset = (bit_index / BITS_IN_UINT8);
+  index_type byte_offset = (bit_index / BITS_IN_UINT8);
   bit_index = (bit_index % BITS_IN_UINT8);
   *((uint8_t *)(&info[0] + byte_offset)) &= ~((uint8_t)(1 << bit_index));
 }
@@ -205,3 +529,1431 @@ void Pool<T, SIZE>::clrBit(int bit_index)
 } // namespace k2lib
 
 #endif /* end of include guard: POOL_H */
+
+// Zero-copy message passing with the Pool
+
+/* Moving a large message between two threads through the ring buffer of Exercise 1 costs two copies:
+ ring_buffer_put copies the payload in and ring_buffer_get copies it out again.
+ The Channel below avoids both. The producer builds the message directly inside a Pool element
+ and pushes only its slot index (one index_type, often a single byte) through a ring.
+ The consumer turns the index back into a pointer, uses the message in place and releases it.
+ Released indices travel back to the producer through a second ring, so the Pool itself is only ever
+ touched by the producer thread and needs no lock. Both rings follow the scheme of Exercise 1:
+ free running head and tail, a power of two size, and each counter written by one side only.
+ Since at most SIZE messages exist at any time, a ring of at least SIZE entries can never overflow.*/
+
+#ifndef POOL_CHANNEL_H
+#define POOL_CHANNEL_H
+
+#include <atomic>
+
+namespace k2lib
+{
+// namespace k2lib body
+
+/* Smallest power of two which is not less than n. */
+constexpr size_t ceilPow2(size_t n, size_t p = 1)
+{
+  return (p >= n) ? p : ceilPow2(n, p << 1);
+}
+
+template <typename I, size_t N>
+class IndexRing
+{
+public:
+  IndexRing();
+  bool put(I index);  /*!< Producer side: append index, false if the ring is full. */
+  bool get(I *index); /*!< Consumer side: take oldest index, false if the ring is empty. */
+  size_t count();     /*!< Returns number of indices currently in the ring. */
+
+private:
+  static_assert(((N - 1) & N) == 0, "IndexRing size must be a power of 2");
+
+  static const size_t CACHE_LINE = 64; /*!< Keeps head and tail from sharing a cache line. */
+
+  I buf[N];                                        /*!< Slot indices in flight. */
+  alignas(CACHE_LINE) std::atomic<size_t> head;    /*!< Written by the producer only. */
+  alignas(CACHE_LINE) std::atomic<size_t> tail;    /*!< Written by the consumer only. */
+};
+
+template <typename I, size_t N>
+IndexRing<I, N>::IndexRing() : head(0), tail(0)
+{
+}
+
+template <typename I, size_t N>
+bool IndexRing<I, N>::put(I index)
+{
+  const size_t h = head.load(std::memory_order_relaxed);
+
+  // Full when the difference between head and tail equals N
+  if (h - tail.load(std::memory_order_acquire) == N)
+    return false;
+
+  buf[h & (N - 1)] = index;
+  // Publish the index before the new head becomes visible
+  head.store(h + 1, std::memory_order_release);
+  return true;
+}
+
+template <typename I, size_t N>
+bool IndexRing<I, N>::get(I *index)
+{
+  const size_t t = tail.load(std::memory_order_relaxed);
+
+  // Empty when head and tail are equal
+  if (head.load(std::memory_order_acquire) == t)
+    return false;
+
+  *index = buf[t & (N - 1)];
+  // Hand the entry back to the producer only after it has been read
+  tail.store(t + 1, std::memory_order_release);
+  return true;
+}
+
+template <typename I, size_t N>
+size_t IndexRing<I, N>::count()
+{
+  return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+}
+
+template <typename T, size_t SIZE>
+class Channel
+{
+public:
+  typedef typename Pool<T, SIZE>::index_type index_type;
+
+  T *alloc();           /*!< Producer: take a message from the Pool, NULL if all are in flight. */
+  bool send(T *msg);    /*!< Producer: pass message to the consumer without copying it. */
+  T *receive();         /*!< Consumer: take next message, NULL if there is none. */
+  void release(T *msg); /*!< Consumer: give message back to the producer's Pool. */
+
+private:
+  static const size_t RING_SIZE = ceilPow2(SIZE); /*!< Room for every Pool element. */
+
+  Pool<T, SIZE> pool;                           /*!< Message storage, producer only. */
+  IndexRing<index_type, RING_SIZE> sent;        /*!< Producer to consumer. */
+  IndexRing<index_type, RING_SIZE> returned;    /*!< Consumer back to producer. */
+};
+
+template <typename T, size_t SIZE>
+T *Channel<T, SIZE>::alloc()
+{
+  index_type index;
+
+  // Put messages released by the consumer back into the Pool first, so recently used
+  // (and still cached) elements are handed out again
+  while (returned.get(&index))
+    pool.free(pool.at(index));
+
+  return pool.palloc();
+}
+
+template <typename T, size_t SIZE>
+bool Channel<T, SIZE>::send(T *msg)
+{
+  const index_type index = pool.index_of(msg);
+
+  if (Pool<T, SIZE>::NO_INDEX == index)
+    return false;
+
+  return sent.put(index);
+}
+
+template <typename T, size_t SIZE>
+T *Channel<T, SIZE>::receive()
+{
+  index_type index;
+
+  if (!sent.get(&index))
+    return NULL;
+
+  return pool.at(index);
+}
+
+template <typename T, size_t SIZE>
+void Channel<T, SIZE>::release(T *msg)
+{
+  const index_type index = pool.index_of(msg);
+
+  if (Pool<T, SIZE>::NO_INDEX != index)
+    returned.put(index);
+}
+
+} // namespace k2lib
+
+#endif /* end of include guard: POOL_CHANNEL_H */
+
+// Pool allocation from interrupt and signal context
+
+/* The Pool above cannot be used from an interrupt service routine or a signal handler:
+ palloc and free both modify info and free_elements_cnt, and an interrupt arriving in the middle of
+ a free in the application would corrupt them. IsrPool keeps its free elements as slot indices in an
+ IndexRing instead of a bitmap. The interrupt (or signal) context is the only consumer of that ring
+ and the application is the only producer, which is exactly the split the ring buffer of Exercise 1
+ was designed for. palloc is a single ring_buffer_get: no loop, no lock, no retry, so it is wait-free
+ and async-signal-safe as long as the atomics are lock-free. free is a single put from normal context.
+ If several application threads free elements, they must serialize among themselves; the allocating
+ context never waits for them. The same holds for a signal handler that can interrupt itself.*/
+
+#ifndef POOL_ISR_H
+#define POOL_ISR_H
+
+namespace k2lib
+{
+// namespace k2lib body
+
+template <typename T, size_t SIZE>
+class IsrPool
+{
+public:
+  typedef typename PoolIndex<SIZE>::type index_type;
+
+  IsrPool();
+  T *palloc();     /*!< Interrupt/signal context only: take one element, NULL if none is free. */
+  void free(T *p); /*!< Normal context only: give back element of given argument pointer. */
+  size_t size();   /*!< Returns count of free IsrPool elements. */
+
+  index_type index_of(const T *p); /*!< Returns handle of element, SIZE if p is not from this IsrPool. */
+  T *at(index_type index);         /*!< Returns element of given handle, NULL if out of range. */
+
+private:
+#if __cplusplus >= 201703L
+  static_assert(std::atomic<size_t>::is_always_lock_free,
+                "IsrPool needs lock-free atomics to be async-signal-safe");
+#endif
+
+  T elements[SIZE];                                /*!< Holds the pool objects. */
+  std::atomic<bool> allocated[SIZE];               /*!< Set by palloc, cleared by free, catches double frees. */
+  IndexRing<index_type, ceilPow2(SIZE)> free_ring; /*!< Indices of free elements. */
+};
+
+template <typename T, size_t SIZE>
+IsrPool<T, SIZE>::IsrPool()
+{
+  // All elements start out free
+  for (size_t i = 0; i < SIZE; i++)
+  {
+    allocated[i].store(false, std::memory_order_relaxed);
+    free_ring.put((index_type)i);
+  }
+}
+
+template <typename T, size_t SIZE>
+T *IsrPool<T, SIZE>::palloc()
+{
+  index_type index;
+
+  if (!free_ring.get(&index))
+    return NULL;
+
+  allocated[index].store(true, std::memory_order_relaxed);
+  return &elements[index];
+}
+
+template <typename T, size_t SIZE>
+void IsrPool<T, SIZE>::free(T *p)
+{
+  const index_type index = index_of(p);
+
+  // Cannot free NULL or a foreign pointer
+  if (index >= SIZE)
+    return;
+
+  // Cannot free an element twice, it would be handed out twice
+  if (!allocated[index].exchange(false, std::memory_order_relaxed))
+    return;
+
+  free_ring.put(index);
+}
+
+template <typename T, size_t SIZE>
+size_t IsrPool<T, SIZE>::size()
+{
+  return free_ring.count();
+}
+
+template <typename T, size_t SIZE>
+typename IsrPool<T, SIZE>::index_type IsrPool<T, SIZE>::index_of(const T *p)
+{
+  if (p < &elements[0] || p >= &elements[0] + SIZE)
+    return SIZE;
+
+  return (index_type)(p - &elements[0]);
+}
+
+template <typename T, size_t SIZE>
+T *IsrPool<T, SIZE>::at(index_type index)
+{
+  if (index >= SIZE)
+    return NULL;
+
+  return &elements[index];
+}
+
+} // namespace k2lib
+
+#endif /* end of include guard: POOL_ISR_H */
+
+// Bounded-latency allocation of variable sized blocks (TLSF)
+
+/* The Pool only hands out elements of one type, and malloc gives no upper bound on how long a call may take.
+ Tlsf is a Two-Level Segregated Fit allocator working over a memory region provided by the user.
+ Free blocks are kept in lists indexed by two levels: the first level is the power of two of the block size,
+ the second level splits each power of two range into SL_COUNT equal parts. Each level has a bitmap of non empty lists,
+ so finding a suitable free block is two find-first-set instructions instead of a search.
+ Every block starts with a small header holding its size and a pointer to the physically previous block,
+ which lets free merge a block with both neighbours in constant time.
+ palloc, free and the merging therefore run in O(1) whatever the state of the heap; there are no loops over blocks or lists.
+ The price is some internal fragmentation: a request is rounded up to the next second level boundary (at most 1/32 of its size).*/
+
+#ifndef POOL_TLSF_H
+#define POOL_TLSF_H
+
+namespace k2lib
+{
+// namespace k2lib body
+
+class Tlsf
+{
+public:
+  Tlsf(void *mem, size_t bytes);
+  void *palloc(size_t size);        /*!< Take (allocate) a block of at least size bytes, NULL if none fits. */
+  void free(void *p);               /*!< Give back (free) block of given argument pointer. */
+  size_t block_size(const void *p); /*!< Returns usable size of an allocated block. */
+
+private:
+  struct Block
+  {
+    Block *prev_phys; /*!< Physically previous block, valid only while that block is free. */
+    size_t size;      /*!< Payload size in bytes, lowest bits hold FREE_BIT and PREV_FREE_BIT. */
+    Block *next_free; /*!< Free list links, they are part of the payload once the block is used. */
+    Block *prev_free;
+  };
+
+  static const size_t ALIGN_LOG2 = 4;                           /*!< Payloads are 16 byte aligned. */
+  static const size_t ALIGN = (size_t)1 << ALIGN_LOG2;
+  static const size_t SL_COUNT_LOG2 = 5;                        /*!< 32 second level lists per first level. */
+  static const size_t SL_COUNT = (size_t)1 << SL_COUNT_LOG2;
+  static const size_t FL_SHIFT = SL_COUNT_LOG2 + ALIGN_LOG2;    /*!< Sizes below 2^FL_SHIFT share first level 0. */
+  static const size_t FL_MAX = 32;                              /*!< Blocks are smaller than 2^FL_MAX bytes. */
+  static const size_t FL_COUNT = FL_MAX - FL_SHIFT + 1;
+  static const size_t SMALL_BLOCK = (size_t)1 << FL_SHIFT;
+  static const size_t HEADER = 2 * sizeof(void *);              /*!< prev_phys and size. */
+  static const size_t MIN_BLOCK = 2 * sizeof(void *);           /*!< Room for the free list links. */
+  static const size_t MAX_ALLOC = (size_t)1 << (FL_MAX - 1);    /*!< Largest request palloc accepts. */
+  static const size_t FREE_BIT = 1;
+  static const size_t PREV_FREE_BIT = 2;
+
+  uint32_t fl_bitmap;                  /*!< Bit f set when any list of first level f is non empty. */
+  uint32_t sl_bitmap[FL_COUNT];        /*!< Bit s of entry f set when list [f][s] is non empty. */
+  Block *free_lists[FL_COUNT][SL_COUNT];
+
+  static size_t sizeOf(const Block *b) { return b->size & ~(FREE_BIT | PREV_FREE_BIT); }
+  static char *payload(Block *b) { return (char *)b + HEADER; }
+  static Block *fromPayload(const void *p) { return (Block *)((char *)p - HEADER); }
+  static Block *nextPhys(Block *b) { return (Block *)(payload(b) + sizeOf(b)); }
+  static int fls(size_t x) { return (int)(sizeof(unsigned long long) * 8 - 1) - __builtin_clzll(x); }
+
+  void mapping(size_t size, size_t *fl, size_t *sl);
+  Block *findSuitable(size_t *fl, size_t *sl);
+  void insertBlock(Block *b);
+  void removeBlock(Block *b);
+};
+
+inline Tlsf::Tlsf(void *mem, size_t bytes)
+{
+  fl_bitmap = 0;
+  for (size_t f = 0; f < FL_COUNT; f++)
+  {
+    sl_bitmap[f] = 0;
+    for (size_t s = 0; s < SL_COUNT; s++)
+      free_lists[f][s] = NULL;
+  }
+
+  // Use the aligned part of the region, and no more than the largest block size
+  uintptr_t start = ((uintptr_t)mem + ALIGN - 1) & ~(uintptr_t)(ALIGN - 1);
+  uintptr_t end = ((uintptr_t)mem + bytes) & ~(uintptr_t)(ALIGN - 1);
+  if (NULL == mem || end < start + 2 * HEADER + MIN_BLOCK)
+    return;
+  if (end - start > ((size_t)1 << (FL_MAX - 1)))
+    end = start + ((size_t)1 << (FL_MAX - 1));
+
+  // One free block spans the region, followed by an empty used block which stops merging at the end
+  Block *b = (Block *)start;
+  b->prev_phys = NULL;
+  b->size = (end - start - 2 * HEADER) | FREE_BIT;
+  insertBlock(b);
+
+  Block *sentinel = nextPhys(b);
+  sentinel->prev_phys = b;
+  sentinel->size = 0 | PREV_FREE_BIT;
+}
+
+inline void *Tlsf::palloc(size_t size)
+{
+  size_t adjust = (size + ALIGN - 1) & ~(ALIGN - 1);
+  if (adjust < MIN_BLOCK)
+    adjust = MIN_BLOCK;
+  if (adjust < size || adjust > MAX_ALLOC)
+    return NULL;
+
+  // Round up to the next list boundary, so that any block in the found list is large enough
+  size_t search = adjust;
+  if (search >= SMALL_BLOCK)
+    search += ((size_t)1 << (fls(search) - SL_COUNT_LOG2)) - 1;
+
+  size_t fl, sl;
+  mapping(search, &fl, &sl);
+  Block *b = findSuitable(&fl, &sl);
+  if (NULL == b)
+    return NULL;
+  removeBlock(b);
+
+  // Split off the remainder if it can hold a block of its own
+  const size_t remain = sizeOf(b) - adjust;
+  if (remain >= HEADER + MIN_BLOCK)
+  {
+    b->size = adjust | (b->size & PREV_FREE_BIT);
+    Block *r = nextPhys(b);
+    r->size = (remain - HEADER) | FREE_BIT;
+    nextPhys(r)->prev_phys = r;
+    insertBlock(r);
+  }
+  else
+  {
+    b->size &= ~FREE_BIT;
+    nextPhys(b)->size &= ~PREV_FREE_BIT;
+  }
+
+  return payload(b);
+}
+
+inline void Tlsf::free(void *p)
+{
+  // Cannot free NULL pointer
+  if (NULL == p)
+    return;
+
+  Block *b = fromPayload(p);
+  if (b->size & FREE_BIT)
+    return;
+
+  // Merge with the previous block
+  if (b->size & PREV_FREE_BIT)
+  {
+    Block *prev = b->prev_phys;
+    removeBlock(prev);
+    prev->size += HEADER + sizeOf(b);
+    b = prev;
+  }
+  else
+  {
+    b->size |= FREE_BIT;
+  }
+
+  // Merge with the next block
+  Block *next = nextPhys(b);
+  if (next->size & FREE_BIT)
+  {
+    removeBlock(next);
+    b->size += HEADER + sizeOf(next);
+    next = nextPhys(b);
+  }
+
+  next->prev_phys = b;
+  next->size |= PREV_FREE_BIT;
+  insertBlock(b);
+}
+
+inline size_t Tlsf::block_size(const void *p)
+{
+  return (NULL == p) ? 0 : sizeOf(fromPayload(p));
+}
+
+inline void Tlsf::mapping(size_t size, size_t *fl, size_t *sl)
+{
+  if (size < SMALL_BLOCK)
+  {
+    // Small sizes are spread linearly over the lists of first level 0
+    *fl = 0;
+    *sl = size / (SMALL_BLOCK / SL_COUNT);
+  }
+  else
+  {
+    const int f = fls(size);
+    *sl = (size >> (f - SL_COUNT_LOG2)) ^ SL_COUNT;
+    *fl = f - (FL_SHIFT - 1);
+  }
+}
+
+inline Tlsf::Block *Tlsf::findSuitable(size_t *fl, size_t *sl)
+{
+  if (*fl >= FL_COUNT)
+    return NULL;
+
+  // First look for a non empty list in the same first level, then in any larger one
+  uint32_t sl_map = sl_bitmap[*fl] & (~0U << *sl);
+  if (0 == sl_map)
+  {
+    const uint32_t fl_map = (*fl + 1 < 32) ? (fl_bitmap & (~0U << (*fl + 1))) : 0;
+    if (0 == fl_map)
+      return NULL;
+
+    *fl = __builtin_ctz(fl_map);
+    sl_map = sl_bitmap[*fl];
+  }
+  *sl = __builtin_ctz(sl_map);
+
+  return free_lists[*fl][*sl];
+}
+
+inline void Tlsf::insertBlock(Block *b)
+{
+  size_t fl, sl;
+  mapping(sizeOf(b), &fl, &sl);
+
+  b->prev_free = NULL;
+  b->next_free = free_lists[fl][sl];
+  if (NULL != b->next_free)
+    b->next_free->prev_free = b;
+  free_lists[fl][sl] = b;
+
+  fl_bitmap |= 1U << fl;
+  sl_bitmap[fl] |= 1U << sl;
+}
+
+inline void Tlsf::removeBlock(Block *b)
+{
+  size_t fl, sl;
+  mapping(sizeOf(b), &fl, &sl);
+
+  if (NULL != b->next_free)
+    b->next_free->prev_free = b->prev_free;
+  if (NULL != b->prev_free)
+    b->prev_free->next_free = b->next_free;
+  else
+    free_lists[fl][sl] = b->next_free;
+
+  // Clear the bitmap bits once the list runs empty
+  if (NULL == free_lists[fl][sl])
+  {
+    sl_bitmap[fl] &= ~(1U << sl);
+    if (0 == sl_bitmap[fl])
+      fl_bitmap &= ~(1U << fl);
+  }
+}
+
+} // namespace k2lib
+
+#endif /* end of include guard: POOL_TLSF_H */
+
+/* The benchmark below compares the latency of single Tlsf and malloc calls on a fragmented heap.
+ It first fills LIVE_BLOCKS slots with blocks of random size between 16 bytes and 64 KiB
+ (uniform over the powers of two, so small blocks dominate as in real programs) and frees every other one.
+ Then it repeatedly picks a random slot and frees it if it is used or allocates it otherwise, timing every call.
+ Compile the part of this file from "complete implementation" on with -O2 -DK2LIB_TLSF_BENCHMARK.
+ The "clock" line times an empty call: maxima at that level are preemption and timer noise, not allocator work.
+ Tlsf stays within a fixed number of list and header updates per call whatever the fragmentation,
+ while malloc occasionally walks its bins or consolidates fastbins inside a single call.*/
+
+#ifdef K2LIB_TLSF_BENCHMARK
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+
+const size_t LIVE_BLOCKS = 20000;
+const size_t OPERATIONS = 2000000;
+const size_t HEAP_BYTES = (size_t)512 << 20;
+
+size_t randomSize(unsigned int *seed)
+{
+  const int shift = 4 + rand_r(seed) % 13;
+  return ((size_t)1 << shift) + rand_r(seed) % ((size_t)1 << shift);
+}
+
+template <typename ALLOC, typename FREE>
+void benchmark(const char *name, ALLOC alloc, FREE dealloc)
+{
+  std::vector<void *> live(LIVE_BLOCKS, (void *)NULL);
+  std::vector<long> ns;
+  unsigned int seed = 12345;
+
+  ns.reserve(OPERATIONS);
+
+  // Fragment the heap
+  for (size_t i = 0; i < LIVE_BLOCKS; i++)
+    live[i] = alloc(randomSize(&seed));
+  for (size_t i = 0; i < LIVE_BLOCKS; i += 2)
+  {
+    dealloc(live[i]);
+    live[i] = NULL;
+  }
+
+  for (size_t n = 0; n < OPERATIONS; n++)
+  {
+    const size_t i = rand_r(&seed) % LIVE_BLOCKS;
+    const size_t size = randomSize(&seed);
+    const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    if (NULL != live[i])
+    {
+      dealloc(live[i]);
+      live[i] = NULL;
+    }
+    else
+    {
+      live[i] = alloc(size);
+    }
+    const std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+    ns.push_back((long)std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count());
+  }
+
+  for (size_t i = 0; i < LIVE_BLOCKS; i++)
+    dealloc(live[i]);
+
+  std::sort(ns.begin(), ns.end());
+  double sum = 0;
+  for (size_t i = 0; i < ns.size(); i++)
+    sum += ns[i];
+  printf("%-8s mean %7.1f ns  p99 %6ld ns  p99.99 %7ld ns  max %8ld ns\n", name, sum / ns.size(),
+         ns[ns.size() * 99 / 100], ns[ns.size() * 9999 / 10000], ns.back());
+}
+
+} // namespace
+
+int main()
+{
+  void *heap = malloc(HEAP_BYTES);
+  memset(heap, 0, HEAP_BYTES); // fault the pages in up front, so they are not timed
+  k2lib::Tlsf tlsf(heap, HEAP_BYTES);
+
+  // Timing an empty call shows the noise floor of the clock and of the machine itself
+  benchmark("clock", [](size_t) { return (void *)1; }, [](void *) {});
+  benchmark("tlsf", [&](size_t size) { return tlsf.palloc(size); }, [&](void *p) { tlsf.free(p); });
+  benchmark("malloc", [](size_t size) { return malloc(size); }, [](void *p) { free(p); });
+
+  free(heap);
+  return 0;
+}
+
+#endif /* K2LIB_TLSF_BENCHMARK */
+
+// Buddy allocator for power of two block sizes
+
+/* Serving buffers from 256 B to 1 MB with one Pool per size strands memory: a Pool full of free 1 KB elements cannot
+ satisfy a 64 KB request. Buddy keeps one contiguous storage array, like the elements array of the Pool,
+ and carves it into power of two blocks between 2^MIN_ORDER and 2^MAX_ORDER bytes.
+ A request is rounded up to a power of two; a larger free block is split in halves ("buddies") until it fits,
+ and a freed block is merged with its buddy again whenever the buddy is free too, so memory flows back to larger sizes.
+ The address of a block's buddy is its offset with the order bit flipped, and two bitmaps per order record
+ which blocks are free and which were handed out at that order, so neither split nor merge needs a search.
+ free_all gives back every block at once, and stats reports how the free memory is scattered over the orders.*/
+
+#ifndef POOL_BUDDY_H
+#define POOL_BUDDY_H
+
+namespace k2lib
+{
+// namespace k2lib body
+
+template <size_t MIN_ORDER, size_t MAX_ORDER, size_t ROOTS = 1>
+class Buddy
+{
+public:
+  static const size_t ORDERS = MAX_ORDER - MIN_ORDER + 1; /*!< Number of block sizes. */
+
+  struct Stats
+  {
+    size_t free_bytes;           /*!< Total free memory. */
+    size_t largest_free;         /*!< Largest block palloc can return right now. */
+    size_t free_blocks[ORDERS];  /*!< Free blocks of size 2^(MIN_ORDER + i). */
+    unsigned int fragmentation;  /*!< Percentage of free memory not in blocks of the largest free size. */
+  };
+
+  Buddy();
+  void *palloc(size_t size); /*!< Take (allocate) a block of the next power of two size, NULL if none is free. */
+  void free(void *p);        /*!< Give back (free) block of given argument pointer. */
+  void free_all();           /*!< Give back every block at once. */
+  size_t size();             /*!< Returns count of free bytes. */
+  Stats stats();             /*!< Returns count of free blocks per size and fragmentation. */
+
+private:
+  static_assert(MIN_ORDER <= MAX_ORDER, "MIN_ORDER must not exceed MAX_ORDER");
+  static_assert(((size_t)1 << MIN_ORDER) >= 2 * sizeof(void *), "Blocks must hold the free list links");
+  static_assert(ORDERS <= 32, "Too many block sizes");
+
+  struct Node
+  {
+    Node *next; /*!< Free list links, stored in the free block itself. */
+    Node *prev;
+  };
+
+  static const size_t BITS_IN_UINT8 = 8;
+  static const size_t NO_BITS = ROOTS * (((size_t)1 << ORDERS) - 1); /*!< One bit per block of every order. */
+  static const size_t NO_BYTES = (NO_BITS + BITS_IN_UINT8 - 1) / BITS_IN_UINT8;
+
+  alignas(4096) uint8_t storage[ROOTS << MAX_ORDER]; /*!< Memory handed out in blocks. */
+  uint8_t free_info[NO_BYTES];                       /*!< Block is free and in its free list. */
+  uint8_t alloc_info[NO_BYTES];                      /*!< Block was handed out at this order. */
+  Node *free_lists[ORDERS];                          /*!< Free blocks of every order. */
+  size_t free_cnt[ORDERS];                           /*!< Number of blocks in each free list. */
+  uint32_t avail;                                    /*!< Bit o set when free_lists[o] is non empty. */
+
+  /* Position of the bit of the block at given offset in the bitmaps of order o (relative to MIN_ORDER).
+   Orders are stored one after the other, the smallest first. */
+  static size_t bitIndex(size_t o, size_t offset)
+  {
+    return ROOTS * (((size_t)1 << ORDERS) - ((size_t)1 << (ORDERS - o))) + (offset >> (MIN_ORDER + o));
+  }
+  static bool testBit(const uint8_t *info, size_t i) { return 0 != (info[i / BITS_IN_UINT8] & (uint8_t)(1 << (i % BITS_IN_UINT8))); }
+  static void setBit(uint8_t *info, size_t i) { info[i / BITS_IN_UINT8] |= (uint8_t)(1 << (i % BITS_IN_UINT8)); }
+  static void clrBit(uint8_t *info, size_t i) { info[i / BITS_IN_UINT8] &= ~((uint8_t)(1 << (i % BITS_IN_UINT8))); }
+
+  void push(size_t o, size_t offset);
+  void remove(size_t o, size_t offset);
+};
+
+template <size_t MIN_ORDER, size_t MAX_ORDER, size_t ROOTS>
+Buddy<MIN_ORDER, MAX_ORDER, ROOTS>::Buddy()
+{
+  free_all();
+}
+
+template <size_t MIN_ORDER, size_t MAX_ORDER, size_t ROOTS>
+void Buddy<MIN_ORDER, MAX_ORDER, ROOTS>::free_all()
+{
+  for (size_t i = 0; i < NO_BYTES; i++)
+  {
+    free_info[i] = 0;
+    alloc_info[i] = 0;
+  }
+  for (size_t o = 0; o < ORDERS; o++)
+  {
+    free_lists[o] = NULL;
+    free_cnt[o] = 0;
+  }
+  avail = 0;
+
+  // The storage starts out as ROOTS free blocks of the largest size
+  for (size_t r = 0; r < ROOTS; r++)
+    push(ORDERS - 1, r << MAX_ORDER);
+}
+
+template <size_t MIN_ORDER, size_t MAX_ORDER, size_t ROOTS>
+void *Buddy<MIN_ORDER, MAX_ORDER, ROOTS>::palloc(size_t size)
+{
+  // Find the order of the request
+  size_t o = 0;
+  while (o < ORDERS && ((size_t)1 << (MIN_ORDER + o)) < size)
+    o++;
+  if (o == ORDERS)
+    return NULL;
+
+  // Smallest non empty free list of that order or above
+  const uint32_t candidates = avail & (~0U << o);
+  if (0 == candidates)
+    return NULL;
+  size_t k = __builtin_ctz(candidates);
+
+  const size_t offset = (size_t)((uint8_t *)free_lists[k] - storage);
+  remove(k, offset);
+
+  // Split down to the requested order, keeping the upper halves free
+  while (k > o)
+  {
+    k--;
+    push(k, offset + ((size_t)1 << (MIN_ORDER + k)));
+  }
+
+  setBit(alloc_info, bitIndex(o, offset));
+  return &storage[offset];
+}
+
+template <size_t MIN_ORDER, size_t MAX_ORDER, size_t ROOTS>
+void Buddy<MIN_ORDER, MAX_ORDER, ROOTS>::free(void *p)
+{
+  // Cannot free NULL pointer or memory outside the storage
+  if (NULL == p || (uint8_t *)p < storage || (uint8_t *)p >= storage + sizeof(storage))
+    return;
+
+  size_t offset = (size_t)((uint8_t *)p - storage);
+
+  // The alloc bitmaps tell at which order the block was handed out
+  size_t o = 0;
+  while (o < ORDERS && ((offset & (((size_t)1 << (MIN_ORDER + o)) - 1)) != 0 ||
+                        !testBit(alloc_info, bitIndex(o, offset))))
+    o++;
+  if (o == ORDERS)
+    return;
+  clrBit(alloc_info, bitIndex(o, offset));
+
+  // Merge with the buddy as long as it is free as a whole
+  while (o < ORDERS - 1)
+  {
+    const size_t buddy = offset ^ ((size_t)1 << (MIN_ORDER + o));
+    if (!testBit(free_info, bitIndex(o, buddy)))
+      break;
+    remove(o, buddy);
+    offset &= ~((size_t)1 << (MIN_ORDER + o));
+    o++;
+  }
+
+  push(o, offset);
+}
+
+template <size_t MIN_ORDER, size_t MAX_ORDER, size_t ROOTS>
+size_t Buddy<MIN_ORDER, MAX_ORDER, ROOTS>::size()
+{
+  size_t bytes = 0;
+  for (size_t o = 0; o < ORDERS; o++)
+    bytes += free_cnt[o] << (MIN_ORDER + o);
+  return bytes;
+}
+
+template <size_t MIN_ORDER, size_t MAX_ORDER, size_t ROOTS>
+typename Buddy<MIN_ORDER, MAX_ORDER, ROOTS>::Stats Buddy<MIN_ORDER, MAX_ORDER, ROOTS>::stats()
+{
+  Stats s;
+
+  s.free_bytes = size();
+  s.largest_free = 0;
+  s.fragmentation = 0;
+  for (size_t o = 0; o < ORDERS; o++)
+    s.free_blocks[o] = free_cnt[o];
+
+  if (0 != avail)
+  {
+    const size_t top = 31 - __builtin_clz(avail);
+    s.largest_free = (size_t)1 << (MIN_ORDER + top);
+    s.fragmentation = (unsigned int)(100 - (100 * (free_cnt[top] << (MIN_ORDER + top))) / s.free_bytes);
+  }
+
+  return s;
+}
+
+template <size_t MIN_ORDER, size_t MAX_ORDER, size_t ROOTS>
+void Buddy<MIN_ORDER, MAX_ORDER, ROOTS>::push(size_t o, size_t offset)
+{
+  Node *n = (Node *)&storage[offset];
+
+  n->prev = NULL;
+  n->next = free_lists[o];
+  if (NULL != n->next)
+    n->next->prev = n;
+  free_lists[o] = n;
+
+  free_cnt[o]++;
+  avail |= 1U << o;
+  setBit(free_info, bitIndex(o, offset));
+}
+
+template <size_t MIN_ORDER, size_t MAX_ORDER, size_t ROOTS>
+void Buddy<MIN_ORDER, MAX_ORDER, ROOTS>::remove(size_t o, size_t offset)
+{
+  Node *n = (Node *)&storage[offset];
+
+  if (NULL != n->next)
+    n->next->prev = n->prev;
+  if (NULL != n->prev)
+    n->prev->next = n->next;
+  else
+    free_lists[o] = n->next;
+
+  if (0 == --free_cnt[o])
+    avail &= ~(1U << o);
+  clrBit(free_info, bitIndex(o, offset));
+}
+
+} // namespace k2lib
+
+#endif /* end of include guard: POOL_BUDDY_H */
+
+// Routing malloc through Pool slabs (LD_PRELOAD)
+
+/* To measure what the Pool gains in an unmodified program, the section below builds into a shared library
+ which replaces malloc, free, calloc, realloc and posix_memalign:
+
+   g++ -O2 -shared -fPIC -DK2LIB_MALLOC_INTERPOSER -x c++ pool.h -o libk2pool.so
+   LD_PRELOAD=./libk2pool.so ./program
+
+ (pool.h being this file from "complete implementation" on).
+ Requests up to MAX_SMALL bytes are rounded up to one of seven size classes, 16 to 1024 bytes.
+ Every thread owns slabs of SLAB_BYTES per class; a slab is a header followed by a Pool of chunks of that class.
+ All slabs are cut from one reserved address range and are aligned to their size, so free recognizes a slab pointer
+ by a range check and finds its header by masking the low address bits. Everything else goes to the C library.
+ A chunk freed by a thread which does not own the slab is pushed onto the slab's lock-free remote list,
+ and the owner moves those chunks back into its Pool when it runs out. Slabs of exited threads are not reused.*/
+
+#ifdef K2LIB_MALLOC_INTERPOSER
+
+#include <atomic>
+#include <dlfcn.h>
+#include <errno.h>
+#include <new>
+#include <string.h>
+#include <sys/mman.h>
+
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void __libc_free(void *p);
+extern "C" void *__libc_calloc(size_t n, size_t size);
+extern "C" void *__libc_realloc(void *p, size_t size);
+extern "C" void *__libc_memalign(size_t alignment, size_t size);
+
+namespace k2lib
+{
+namespace interposer
+{
+
+const size_t SLAB_BYTES = 64 * 1024;          /*!< Size and alignment of a slab. */
+const size_t ARENA_BYTES = (size_t)64 << 30;  /*!< Address space reserved for all slabs. */
+const size_t MIN_SHIFT = 4;                   /*!< Smallest size class is 16 bytes. */
+const size_t CLASSES = 7;                     /*!< 16, 32, ... 1024 bytes. */
+const size_t MAX_SMALL = (size_t)1 << (MIN_SHIFT + CLASSES - 1);
+
+struct SlabHeader
+{
+  size_t cls;                  /*!< Size class of the chunks. */
+  uint64_t owner;              /*!< Id of the thread allocating from this slab. */
+  SlabHeader *next;            /*!< Next slab of the same class and owner. */
+  std::atomic<void *> remote;  /*!< Chunks freed by other threads, linked through their first word. */
+};
+
+template <size_t CLASS_SIZE>
+struct Chunk
+{
+  alignas(16) uint8_t bytes[CLASS_SIZE];
+};
+
+template <size_t CLASS_SIZE>
+struct Slab
+{
+  /* Pool capacity which fits the slab: every chunk costs CLASS_SIZE bytes plus one bit of info */
+  static const size_t CHUNKS = (SLAB_BYTES - 128) * 8 / (8 * CLASS_SIZE + 1);
+
+  SlabHeader hdr;
+  Pool<Chunk<CLASS_SIZE>, CHUNKS> pool;
+};
+
+/* Per class operations, so the slab code below does not depend on the Pool template arguments */
+struct ClassOps
+{
+  size_t size;
+  void (*init)(void *mem);
+  void *(*alloc)(SlabHeader *h);
+  void (*release)(SlabHeader *h, void *p);
+};
+
+template <size_t CLASS_SIZE>
+struct ClassImpl
+{
+  static_assert(sizeof(Slab<CLASS_SIZE>) <= SLAB_BYTES, "Slab does not fit");
+
+  static void init(void *mem) { new (mem) Slab<CLASS_SIZE>(); }
+  static void *alloc(SlabHeader *h) { return ((Slab<CLASS_SIZE> *)h)->pool.palloc(); }
+  static void release(SlabHeader *h, void *p) { ((Slab<CLASS_SIZE> *)h)->pool.free((Chunk<CLASS_SIZE> *)p); }
+};
+
+#define K2LIB_CLASS_OPS(n) {n, ClassImpl<n>::init, ClassImpl<n>::alloc, ClassImpl<n>::release}
+const ClassOps ops[CLASSES] = {K2LIB_CLASS_OPS(16), K2LIB_CLASS_OPS(32), K2LIB_CLASS_OPS(64),
+                               K2LIB_CLASS_OPS(128), K2LIB_CLASS_OPS(256), K2LIB_CLASS_OPS(512),
+                               K2LIB_CLASS_OPS(1024)};
+#undef K2LIB_CLASS_OPS
+
+struct ThreadCache
+{
+  uint64_t id;                  /*!< Never reused, 0 until the first small allocation. */
+  SlabHeader *slabs[CLASSES];   /*!< Owned slabs, the first one is allocated from. */
+};
+
+std::atomic<uintptr_t> arena_base(0);
+std::atomic<size_t> arena_used(0);
+std::atomic<uint64_t> thread_ids(0);
+
+// initial-exec avoids __tls_get_addr, which may call malloc itself
+static __thread ThreadCache tcache __attribute__((tls_model("initial-exec")));
+
+uintptr_t arena()
+{
+  uintptr_t base = arena_base.load(std::memory_order_acquire);
+  if (0 != base)
+    return base;
+
+  void *mem = mmap(NULL, ARENA_BYTES + SLAB_BYTES, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (MAP_FAILED == mem)
+    return 0;
+
+  // Only one thread's reservation is kept
+  uintptr_t aligned = ((uintptr_t)mem + SLAB_BYTES - 1) & ~(uintptr_t)(SLAB_BYTES - 1);
+  if (!arena_base.compare_exchange_strong(base, aligned, std::memory_order_acq_rel))
+  {
+    munmap(mem, ARENA_BYTES + SLAB_BYTES);
+    return base;
+  }
+  return aligned;
+}
+
+bool inArena(const void *p)
+{
+  const uintptr_t base = arena_base.load(std::memory_order_acquire);
+  return (0 != base) && ((uintptr_t)p - base < ARENA_BYTES);
+}
+
+size_t classOf(size_t size)
+{
+  size_t cls = 0;
+  while (((size_t)1 << (MIN_SHIFT + cls)) < size)
+    cls++;
+  return cls;
+}
+
+SlabHeader *newSlab(size_t cls)
+{
+  const uintptr_t base = arena();
+  if (0 == base)
+    return NULL;
+
+  const size_t offset = arena_used.fetch_add(SLAB_BYTES, std::memory_order_relaxed);
+  if (offset + SLAB_BYTES > ARENA_BYTES)
+    return NULL;
+
+  SlabHeader *h = (SlabHeader *)(base + offset);
+  ops[cls].init(h);
+  h->cls = cls;
+  h->owner = tcache.id;
+  h->next = NULL;
+  h->remote.store(NULL, std::memory_order_relaxed);
+  return h;
+}
+
+/* Moves chunks freed by other threads back into the owner's Pool */
+void drainRemote(SlabHeader *h)
+{
+  void *p = h->remote.exchange(NULL, std::memory_order_acquire);
+  while (NULL != p)
+  {
+    void *next = *(void **)p;
+    ops[h->cls].release(h, p);
+    p = next;
+  }
+}
+
+void *smallAlloc(size_t size)
+{
+  const size_t cls = classOf(size);
+
+  if (0 == tcache.id)
+    tcache.id = thread_ids.fetch_add(1, std::memory_order_relaxed) + 1;
+
+  // Try the current slab, then every other owned slab, moving the one that has room to the front
+  SlabHeader **link = &tcache.slabs[cls];
+  for (SlabHeader *h = *link; NULL != h; link = &h->next, h = *link)
+  {
+    void *p = ops[cls].alloc(h);
+    if (NULL == p)
+    {
+      drainRemote(h);
+      p = ops[cls].alloc(h);
+    }
+    if (NULL != p)
+    {
+      if (h != tcache.slabs[cls])
+      {
+        *link = h->next;
+        h->next = tcache.slabs[cls];
+        tcache.slabs[cls] = h;
+      }
+      return p;
+    }
+  }
+
+  SlabHeader *h = newSlab(cls);
+  if (NULL == h)
+    return __libc_malloc(size);
+  h->next = tcache.slabs[cls];
+  tcache.slabs[cls] = h;
+  return ops[cls].alloc(h);
+}
+
+void smallFree(void *p)
+{
+  SlabHeader *h = (SlabHeader *)((uintptr_t)p & ~(uintptr_t)(SLAB_BYTES - 1));
+
+  if (h->owner == tcache.id)
+  {
+    ops[h->cls].release(h, p);
+    return;
+  }
+
+  // Somebody else's slab: push onto its remote list
+  void *head = h->remote.load(std::memory_order_relaxed);
+  do
+  {
+    *(void **)p = head;
+  } while (!h->remote.compare_exchange_weak(head, p, std::memory_order_release, std::memory_order_relaxed));
+}
+
+size_t chunkSize(const void *p)
+{
+  const SlabHeader *h = (const SlabHeader *)((uintptr_t)p & ~(uintptr_t)(SLAB_BYTES - 1));
+  return ops[h->cls].size;
+}
+
+} // namespace interposer
+} // namespace k2lib
+
+using namespace k2lib::interposer;
+
+extern "C" void *malloc(size_t size)
+{
+  return (size <= MAX_SMALL) ? smallAlloc(size) : __libc_malloc(size);
+}
+
+extern "C" void free(void *p)
+{
+  if (NULL == p)
+    return;
+
+  if (inArena(p))
+    smallFree(p);
+  else
+    __libc_free(p);
+}
+
+extern "C" void *calloc(size_t n, size_t size)
+{
+  if (0 != size && n > (size_t)-1 / size)
+  {
+    errno = ENOMEM;
+    return NULL;
+  }
+  if (n * size > MAX_SMALL)
+    return __libc_calloc(n, size);
+
+  // Chunks are reused, so they have to be cleared
+  void *p = smallAlloc(n * size);
+  if (NULL != p)
+    memset(p, 0, n * size);
+  return p;
+}
+
+extern "C" void *realloc(void *p, size_t size)
+{
+  if (NULL == p)
+    return malloc(size);
+  if (0 == size)
+  {
+    free(p);
+    return NULL;
+  }
+  if (!inArena(p))
+    return __libc_realloc(p, size);
+
+  // Still fits the chunk
+  const size_t old = chunkSize(p);
+  if (size <= old)
+    return p;
+
+  void *q = malloc(size);
+  if (NULL != q)
+  {
+    memcpy(q, p, old);
+    smallFree(p);
+  }
+  return q;
+}
+
+extern "C" int posix_memalign(void **out, size_t alignment, size_t size)
+{
+  if (0 == alignment || 0 != (alignment & (alignment - 1)) || 0 != alignment % sizeof(void *))
+    return EINVAL;
+
+  // Chunks are 16 byte aligned
+  void *p = (alignment <= 16 && size <= MAX_SMALL) ? smallAlloc(size) : __libc_memalign(alignment, size);
+  if (NULL == p)
+    return ENOMEM;
+
+  *out = p;
+  return 0;
+}
+
+extern "C" size_t malloc_usable_size(void *p)
+{
+  typedef size_t (*usable_size_fn)(void *);
+  static usable_size_fn next_usable_size = NULL;
+
+  if (NULL == p)
+    return 0;
+  if (inArena(p))
+    return chunkSize(p);
+
+  // The C library has no __libc_ alias for this one
+  if (NULL == next_usable_size)
+    next_usable_size = (usable_size_fn)dlsym(RTLD_NEXT, "malloc_usable_size");
+  return (NULL != next_usable_size) ? next_usable_size(p) : 0;
+}
+
+#endif /* K2LIB_MALLOC_INTERPOSER */
+
+// Sharing a Pool between processes
+
+/* SharedPool places both its control data and its elements in a named POSIX shared memory segment,
+ so that several processes can take and give back elements concurrently.
+ Each process maps the segment at a different address, so raw pointers cannot be passed between them.
+ Elements are instead identified by handles: the byte offset of the element from the start of the segment,
+ which is the same in every process. A handle fits into an IndexRing placed in shared memory,
+ which gives zero-copy transfer from a capture process to a processing process.
+ The free elements form a lock-free stack of slot indices. Its head holds the index of the top element
+ together with a tag that is incremented on every change, so that a stale compare-and-swap cannot succeed
+ after the same index was taken and given back in between (the ABA problem).
+ Lock-free atomics work across processes as long as they are lock-free; no process can block the others,
+ but an element held by a process which dies is lost until the segment is created again.
+ T itself must not contain pointers, for the same reason.*/
+
+#ifndef POOL_SHARED_H
+#define POOL_SHARED_H
+
+#include <atomic>
+#include <fcntl.h>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace k2lib
+{
+// namespace k2lib body
+
+template <typename T, size_t SIZE>
+class SharedPool
+{
+public:
+  typedef typename PoolIndex<SIZE>::type index_type;
+  typedef uint64_t handle_type; /*!< Offset of an element from the start of the segment. */
+
+  static const handle_type NO_HANDLE = 0; /*!< Offset 0 is the control data, never an element. */
+
+  static SharedPool *create(const char *name); /*!< Create and map a new segment, NULL on error. */
+  static SharedPool *open(const char *name);   /*!< Map a segment created by another process, NULL on error. */
+  static void close(SharedPool *pool);         /*!< Unmap the segment from this process. */
+  static int unlink(const char *name);         /*!< Remove the segment name, 0 on success. */
+
+  T *palloc();     /*!< Take (allocate) one element from the Pool. */
+  void free(T *p); /*!< Give back (free) element of given argument pointer. */
+  size_t size();   /*!< Returns count of free Pool elements. */
+
+  handle_type handle_of(const T *p);  /*!< Returns position independent handle of element, NO_HANDLE if foreign. */
+  T *from_handle(handle_type handle); /*!< Returns element of handle in this process, NULL if invalid. */
+
+private:
+  static_assert(SIZE < 0xFFFFFFFFU, "SharedPool indices must fit into 32 bits");
+
+  static const uint32_t MAGIC = 0x4B32504FU;  /*!< Written last by the creator. */
+  static const uint64_t INDEX_MASK = 0xFFFFFFFFU;
+  static const unsigned OPEN_TIMEOUT_MS = 1000; /*!< How long open waits for a creator to finish. */
+
+  std::atomic<uint32_t> ready;            /*!< MAGIC once the creator has initialized the segment. */
+  std::atomic<uint64_t> head;             /*!< Tag in the upper, index of the top free element in the lower 32 bits. */
+  std::atomic<uint64_t> free_cnt;         /*!< Counts number of free elements */
+  std::atomic<index_type> next[SIZE];     /*!< Index of the next free element, SIZE ends the stack. */
+  std::atomic<bool> allocated[SIZE];      /*!< Set by palloc, cleared by free, catches double frees. */
+  T elements[SIZE];                       /*!< Holds the pool objects. */
+
+  SharedPool();
+  static SharedPool *map(int fd);
+  static bool wait(unsigned *waited_ms);
+};
+
+template <typename T, size_t SIZE>
+const typename SharedPool<T, SIZE>::handle_type SharedPool<T, SIZE>::NO_HANDLE;
+
+template <typename T, size_t SIZE>
+SharedPool<T, SIZE>::SharedPool() : ready(0), head(0), free_cnt(SIZE)
+{
+  // Chain all elements into the free stack
+  for (size_t i = 0; i < SIZE; i++)
+  {
+    next[i].store((index_type)(i + 1), std::memory_order_relaxed);
+    allocated[i].store(false, std::memory_order_relaxed);
+  }
+}
+
+template <typename T, size_t SIZE>
+SharedPool<T, SIZE> *SharedPool<T, SIZE>::map(int fd)
+{
+  void *mem = mmap(NULL, sizeof(SharedPool), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  return (MAP_FAILED == mem) ? NULL : (SharedPool *)mem;
+}
+
+template <typename T, size_t SIZE>
+bool SharedPool<T, SIZE>::wait(unsigned *waited_ms)
+{
+  // A creator which died half way would otherwise keep open waiting forever
+  if (*waited_ms >= OPEN_TIMEOUT_MS)
+    return false;
+
+  const struct timespec ms = {0, 1000000};
+  nanosleep(&ms, NULL);
+  (*waited_ms)++;
+  return true;
+}
+
+template <typename T, size_t SIZE>
+SharedPool<T, SIZE> *SharedPool<T, SIZE>::create(const char *name)
+{
+  // Fail if the segment exists already, only one process may initialize it
+  const int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0)
+    return NULL;
+  if (ftruncate(fd, sizeof(SharedPool)) != 0)
+  {
+    ::close(fd);
+    shm_unlink(name);
+    return NULL;
+  }
+
+  SharedPool *pool = map(fd);
+  if (NULL == pool)
+  {
+    shm_unlink(name);
+    return NULL;
+  }
+
+  new (pool) SharedPool();
+  pool->ready.store(MAGIC, std::memory_order_release);
+  return pool;
+}
+
+template <typename T, size_t SIZE>
+SharedPool<T, SIZE> *SharedPool<T, SIZE>::open(const char *name)
+{
+  const int fd = shm_open(name, O_RDWR, 0);
+  if (fd < 0)
+    return NULL;
+
+  // The creator may not have sized the segment yet
+  struct stat st;
+  unsigned waited_ms = 0;
+  int sized;
+  while ((sized = fstat(fd, &st)) == 0 && (size_t)st.st_size < sizeof(SharedPool) && wait(&waited_ms))
+    ;
+  if (sized != 0 || (size_t)st.st_size != sizeof(SharedPool))
+  {
+    ::close(fd);
+    return NULL;
+  }
+
+  SharedPool *pool = map(fd);
+  if (NULL == pool)
+    return NULL;
+
+  // Wait until the creator has finished the initialization
+  while (pool->ready.load(std::memory_order_acquire) != MAGIC)
+  {
+    if (!wait(&waited_ms))
+    {
+      close(pool);
+      return NULL;
+    }
+  }
+  return pool;
+}
+
+template <typename T, size_t SIZE>
+void SharedPool<T, SIZE>::close(SharedPool *pool)
+{
+  if (NULL != pool)
+    munmap(pool, sizeof(SharedPool));
+}
+
+template <typename T, size_t SIZE>
+int SharedPool<T, SIZE>::unlink(const char *name)
+{
+  return shm_unlink(name);
+}
+
+template <typename T, size_t SIZE>
+T *SharedPool<T, SIZE>::palloc()
+{
+  uint64_t old = head.load(std::memory_order_acquire);
+  uint64_t top;
+
+  do
+  {
+    top = old & INDEX_MASK;
+    // Test whether there are any free elements
+    if (top >= SIZE)
+      return NULL;
+  } while (!head.compare_exchange_weak(old, ((old & ~INDEX_MASK) + (INDEX_MASK + 1)) |
+                                                next[top].load(std::memory_order_relaxed),
+                                       std::memory_order_acq_rel, std::memory_order_acquire));
+
+  allocated[top].store(true, std::memory_order_relaxed);
+  free_cnt.fetch_sub(1, std::memory_order_relaxed);
+  return &elements[top];
+}
+
+template <typename T, size_t SIZE>
+void SharedPool<T, SIZE>::free(T *p)
+{
+  // Cannot free NULL, a foreign pointer or one into the middle of an element
+  const size_t offset = (size_t)((const uint8_t *)p - (const uint8_t *)&elements[0]);
+  if (p < &elements[0] || offset >= sizeof(elements) || 0 != offset % sizeof(T))
+    return;
+
+  const index_type index = (index_type)(offset / sizeof(T));
+
+  // A second free would push the index again and hand the element to two processes
+  if (!allocated[index].exchange(false, std::memory_order_relaxed))
+    return;
+
+  uint64_t old = head.load(std::memory_order_relaxed);
+
+  do
+  {
+    next[index].store((index_type)(old & INDEX_MASK), std::memory_order_relaxed);
+  } while (!head.compare_exchange_weak(old, ((old & ~INDEX_MASK) + (INDEX_MASK + 1)) | index,
+                                       std::memory_order_release, std::memory_order_relaxed));
+
+  free_cnt.fetch_add(1, std::memory_order_relaxed);
+}
+
+template <typename T, size_t SIZE>
+size_t SharedPool<T, SIZE>::size()
+{
+  return (size_t)free_cnt.load(std::memory_order_relaxed);
+}
+
+template <typename T, size_t SIZE>
+typename SharedPool<T, SIZE>::handle_type SharedPool<T, SIZE>::handle_of(const T *p)
+{
+  if (p < &elements[0] || p >= &elements[0] + SIZE)
+    return NO_HANDLE;
+
+  return (handle_type)((const uint8_t *)p - (const uint8_t *)this);
+}
+
+template <typename T, size_t SIZE>
+T *SharedPool<T, SIZE>::from_handle(handle_type handle)
+{
+  const handle_type first = (handle_type)((uint8_t *)&elements[0] - (uint8_t *)this);
+
+  // Only offsets of element starts are valid handles
+  if (handle < first || handle >= first + SIZE * sizeof(T) || (handle - first) % sizeof(T) != 0)
+    return NULL;
+
+  return (T *)((uint8_t *)this + handle);
+}
+
+} // namespace k2lib
+
+#endif /* end of include guard: POOL_SHARED_H */
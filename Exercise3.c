@@ -1,5 +1,21 @@
+/* POSIX calls (mmap, posix_madvise, fork) are also declared when compiling with -std=c11 */
+#define _POSIX_C_SOURCE 200809L
 #include<stdio.h>
 #include<stdlib.h>
+#include<stdint.h>
+#include<string.h>
+#include<limits.h>
+#include<stdatomic.h>
+#include<time.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<sys/types.h>
+#include<sys/wait.h>
+#ifdef __SSE2__
+#include<emmintrin.h>
+#endif
  
 struct data 
 {
@@ -7,127 +23,2666 @@ struct data
 	int value;
 };
  
-struct data *array;
-int capacity = 10;
-int size = 0;
+/* Every slot has a control byte in a separate array: EMPTY, DELETED (a slot of the old array during a resize
+   whose key has been moved or removed), or for a used slot USED plus the 7 bit tag of its key's hash. A search compares
+   the tag against the control bytes of GROUP_WIDTH slots at once and only reads the keys of slots
+   whose tag matches, so most hits and misses are resolved from one cache line of control bytes.
+   EMPTY is 0, so a new control array comes zeroed from calloc, which for a large table maps zero pages
+   on demand instead of writing the whole array inside the operation that starts a resize. */
+#define EMPTY 0x00
+#define DELETED 0x01
+#define USED 0x80
+#define GROUP_WIDTH 16
+
+/* smallest capacity the table shrinks to, a power of two and at least GROUP_WIDTH so a group never wraps onto itself */
+#define MIN_CAPACITY 16
+
+/* largest capacity, so that slot counts and 8 * capacity stay within an int and a long long */
+#define MAX_CAPACITY (1 << 30)
+
+/* number of slots moved from the old array to the new one by every operation during a resize */
+#define REHASH_STEP 4
+
+/* The slots are stored as a struct of arrays: control bytes, keys and values each in an array of their own.
+   A search reads only control bytes and keys, so a cache line brings in twice as many keys as with
+   key and value side by side, and the values are read once, for the slot that matched. A scan over the
+   values alone runs over a dense int array, which the compiler can vectorize. Keys and values share one
+   allocation, values = keys + capacity. */
+
+/* All state of one table lives in its handle, so a program can hold any number of independent tables,
+   for example one per thread or per core. A single table must not be used by two threads at once. */
+struct hash_table
+{
+	/* The control array has GROUP_WIDTH - 1 extra bytes after the last slot, which mirror the first ones,
+	   so a group starting near the end can be loaded in one piece and wraps around to slot 0. */
+	uint8_t *ctrl;
+	int *keys;
+	int *values;
+	int capacity;
+	int size;
+	uint64_t seed;
+
+	/* While the table is resized, keys which have not been moved yet are still in old_keys.
+	   Slots below rehash_index have been moved already. */
+	uint8_t *old_ctrl;
+	int *old_keys;
+	int *old_values;
+	int old_capacity;
+	int rehash_index;
+
+	/* a table opened from a snapshot file has its arrays in this read-only mapping, otherwise NULL */
+	void *map;
+	size_t map_size;
+};
  
+/* 64 bit multiply-xorshift mixer (the splitmix64 finalizer): every input bit affects every output bit,
+   so structured keys (multiples of a stride, small ranges) spread uniformly over the table. */
+uint64_t mix64(uint64_t x)
+{
+	x ^= x >> 30;
+	x *= 0xBF58476D1CE4E5B9ULL;
+	x ^= x >> 27;
+	x *= 0x94D049BB133111EBULL;
+	x ^= x >> 31;
+	return x;
+}
+
+/* The hash function can be replaced at compile time, e.g. -DHASH_FUNCTION(key,seed)=my_hash(key,seed).
+   Every table has its own seed, given to create_table, which makes its slot order unpredictable. */
+#ifndef HASH_FUNCTION
+#define HASH_FUNCTION(key, seed) mix64((uint64_t)(uint32_t)(key) ^ (seed))
+#endif
+
+uint64_t hash(const struct hash_table *t, int key)
+{
+	return HASH_FUNCTION(key, t->seed);
+}
+
 /* this function gives a unique hash code to the given key */
-int hashcode(int key)
+/* The capacity is a power of two, so the low bits of the hash select the slot without a division. */
+int hashcode(const struct hash_table *t, int key, int cap)
+{
+	return (int)(hash(t, key) & (uint64_t)(cap - 1));
+}
+
+/* the control byte of a used slot: USED and a 7 bit tag taken from the top bits which hashcode does not use */
+uint8_t hash_tag(const struct hash_table *t, int key)
 {
-	return (key % capacity);
+	return (uint8_t)(USED | hash(t, key) >> 57);
 }
  
-/* it returns prime number just greater than array capacity */
-int get_prime(int n)
+/* Bit i of the result is set when control byte i of the group matches. With SSE2 a group is
+   compared with one instruction and turned into a bit mask by movemask. */
+#ifdef __SSE2__
+unsigned int match_byte(const uint8_t *group, uint8_t c)
 {
-	if (n % 2 == 0) 
-        {
-		n++;
+	__m128i g = _mm_loadu_si128((const __m128i *) group);
+	return (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8((char) c)));
+}
+
+/* slots a new key can take: EMPTY and DELETED are the only control bytes without the USED bit */
+unsigned int match_free(const uint8_t *group)
+{
+	return ~(unsigned int) _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) group)) & 0xFFFF;
+}
+#else
+unsigned int match_byte(const uint8_t *group, uint8_t c)
+{
+	unsigned int mask = 0;
+	int i;
+	for (i = 0; i < GROUP_WIDTH; i++)
+	{
+		mask |= (unsigned int)(group[i] == c) << i;
 	}
-	for (; !if_prime(n); n += 2);
- 
-	return n;
+	return mask;
 }
- 
-/* to check if given input (i.e n) is prime or not */
-int if_prime(int n)
+
+unsigned int match_free(const uint8_t *group)
 {
+	unsigned int mask = 0;
 	int i;
-	if ( n == 1  ||  n == 0) 
-        {
-		return 0;
+	for (i = 0; i < GROUP_WIDTH; i++)
+	{
+		mask |= (unsigned int)!(group[i] & USED) << i;
 	}
-	for (i = 2; i < n; i++) 
-        {
-		if (n % i == 0) 
-                {
-			return 0;
-		}
+	return mask;
+}
+#endif
+
+/* sets the control byte of a slot and its mirror after the end of the array */
+void set_ctrl(uint8_t *c, int cap, int index, uint8_t value)
+{
+	c[index] = value;
+	if (index < GROUP_WIDTH - 1)
+	{
+		c[cap + index] = value;
 	}
-	return 1;
+}
+
+uint8_t *new_ctrl(int cap)
+{
+	/*  all EMPTY  */
+	return (uint8_t*) calloc((size_t) cap + GROUP_WIDTH - 1, 1);
 }
  
-void init_array()
+/* to create an empty table with room for at least capacity keys, returns NULL if out of memory */
+struct hash_table *create_table(int capacity, uint64_t seed)
 {
-	int i;
-	capacity = get_prime(capacity);
-	array = (struct data*) malloc(capacity * sizeof(struct data));
-	for (i = 0; i < capacity; i++) 
-        {
-		array[i].key = 0;
-		array[i].value = 0;
+	struct hash_table *t = (struct hash_table*) calloc(1, sizeof(struct hash_table));
+	int cap = MIN_CAPACITY;
+
+	if (t == NULL)
+	{
+		return NULL;
 	}
+
+	while (cap < capacity && cap < MAX_CAPACITY)
+	{
+		cap *= 2;
+	}
+
+	t->ctrl = new_ctrl(cap);
+	t->keys = (int*) calloc(2 * (size_t) cap, sizeof(int));
+	t->values = t->keys + cap;
+	t->capacity = cap;
+	t->seed = seed;
+
+	if (t->ctrl == NULL || t->keys == NULL)
+	{
+		free(t->ctrl);
+		free(t->keys);
+		free(t);
+		return NULL;
+	}
+
+	return t;
 }
- 
-/* to insert a key in the hash table */
-void insert(int key)
+
+/* to release a table and all its memory */
+void destroy_table(struct hash_table *t)
 {
-	int index = hashcode(key);
-	if (array[index].value == 0) 
-        {
-		/*  key not present, insert it  */
-		array[index].key = key;
-		array[index].value = 1;
-		size++;
-		printf("\n Key (%d) has been inserted \n", key);
+	if (t == NULL)
+	{
+		return;
 	}
-	else if(array[index].key == key) 
-        {
-		/*  updating already existing key  */
-		printf("\n Key (%d) already present, hence updating its value \n", key);
-		array[index].value += 1;
+
+	if (t->map != NULL)
+	{
+		munmap(t->map, t->map_size);
 	}
 	else
-        {
-		/*  key cannot be insert as the index is already containing some other key  */
+	{
+		free(t->ctrl);
+		free(t->keys);
+	}
+	free(t->old_ctrl);
+	free(t->old_keys);
+	free(t);
+}
+
+/* Collisions are resolved by linear probing: if the home slot given by hashcode holds another key,
+   the following slots are tried (wrapping around at the end of the array), one group at a time.
+   A search stops at the first group with an EMPTY slot, because the key would have been stored there.
+   probe returns the slot of key, or -1 if it is not there. If free_index is given, it receives
+   the first slot on the way which a new key could take (a DELETED or EMPTY one), or -1.
+   probe_hash takes the hash of key when the caller has computed it already. */
+int probe_hash(const uint8_t *c, const int *k, int cap, int key, uint64_t h, int *free_index)
+{
+	int pos = (int)(h & (uint64_t)(cap - 1));
+	uint8_t tag = (uint8_t)(USED | h >> 57);
+	unsigned int mask;
+	int g, index;
+
+	if (free_index != NULL)
+	{
+		*free_index = -1;
+	}
+
+	for (g = 0; g <= cap / GROUP_WIDTH; g++)
+	{
+		for (mask = match_byte(c + pos, tag); mask != 0; mask &= mask - 1)
+		{
+			index = (pos + __builtin_ctz(mask)) & (cap - 1);
+			if (k[index] == key)
+			{
+				return index;
+			}
+		}
+
+		mask = match_free(c + pos);
+		if (free_index != NULL && *free_index < 0 && mask != 0)
+		{
+			*free_index = (pos + __builtin_ctz(mask)) & (cap - 1);
+		}
+
+		if (match_byte(c + pos, EMPTY) != 0)
+		{
+			/*  empty slot ends the probe sequence  */
+			return -1;
+		}
+
+		pos = (pos + GROUP_WIDTH) & (cap - 1);
+	}
+
+	return -1;
+}
+
+int probe(const struct hash_table *t, const uint8_t *c, const int *k, int cap, int key, int *free_index)
+{
+	return probe_hash(c, k, cap, key, hash(t, key), free_index);
+}
+
+/* stores a key which is known not to be in the table's arrays */
+void place(struct hash_table *t, int key, int value)
+{
+	int index;
+
+	probe(t, t->ctrl, t->keys, t->capacity, key, &index);
+
+	set_ctrl(t->ctrl, t->capacity, index, hash_tag(t, key));
+	t->keys[index] = key;
+	t->values[index] = value;
+}
+
+void shrink(struct hash_table *t);
+
+/* Resizing is incremental: the old array is kept and every operation moves REHASH_STEP of its
+   slots to the new array, so no single operation pays for rehashing the whole table.
+   When shrinking, the step is scaled by old_capacity / capacity (mostly EMPTY slots, which cost a
+   byte compare each), so a move always ends before the new array can fill up: after growing it is
+   7/16 full and has 7/16 of its capacity to go, after shrinking it has at least half of it to go.
+   Moved slots become DELETED in the old array, so searches there still work until it is freed. */
+void rehash_step(struct hash_table *t, int slots)
+{
+	long long n, budget = slots;
+
+	if (t->old_keys == NULL)
+	{
+		return;
+	}
+
+	if (t->old_capacity > t->capacity)
+	{
+		budget *= t->old_capacity / t->capacity;
+	}
+
+	for (n = 0; n < budget && t->rehash_index < t->old_capacity; n++, t->rehash_index++)
+	{
+		if (t->old_ctrl[t->rehash_index] & USED)
+		{
+			place(t, t->old_keys[t->rehash_index], t->old_values[t->rehash_index]);
+			set_ctrl(t->old_ctrl, t->old_capacity, t->rehash_index, DELETED);
+		}
+	}
+
+	if (t->rehash_index == t->old_capacity)
+	{
+		free(t->old_ctrl);
+		free(t->old_keys);
+		t->old_ctrl = NULL;
+		t->old_keys = NULL;
+		t->old_values = NULL;
+
+		/*  keys removed during the move may have left the new array nearly empty  */
+		shrink(t);
+	}
+}
+
+/* Starts moving the table into a new array of the given capacity. Returns -1 if out of memory,
+   or if a move is still going on, which the step sizes of rehash_step make very unlikely. */
+int resize(struct hash_table *t, int new_capacity)
+{
+	uint8_t *c;
+	int *k;
+
+	if (t->old_keys != NULL)
+	{
+		return -1;
+	}
+
+	c = new_ctrl(new_capacity);
+	k = (int*) calloc(2 * (size_t) new_capacity, sizeof(int));
+	if (c == NULL || k == NULL)
+	{
+		free(c);
+		free(k);
+		return -1;
+	}
+
+	t->old_ctrl = t->ctrl;
+	t->old_keys = t->keys;
+	t->old_values = t->values;
+	t->old_capacity = t->capacity;
+	t->rehash_index = 0;
+
+	t->ctrl = c;
+	t->keys = k;
+	t->values = k + new_capacity;
+	t->capacity = new_capacity;
+	return 0;
+}
+
+/* to look up a key in the hash table, returns 1 and its value if it is present */
+int lookup(struct hash_table *t, int key, int *value)
+{
+	int index;
+
+	rehash_step(t, REHASH_STEP);
+
+	index = probe(t, t->ctrl, t->keys, t->capacity, key, NULL);
+	if (index >= 0)
+	{
+		*value = t->values[index];
+		return 1;
+	}
+
+	if (t->old_keys != NULL && (index = probe(t, t->old_ctrl, t->old_keys, t->old_capacity, key, NULL)) >= 0)
+	{
+		*value = t->old_values[index];
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Batched lookup: for a table much larger than the cache every lookup waits for a cache miss on its home slot,
+   and one lookup after the other these misses are paid one at a time. lookup_batch hashes a group of
+   LOOKUP_BATCH keys first and prefetches their home slots, then probes them, so the misses of a group overlap. */
+#define LOOKUP_BATCH 16
+
+/* looks up n keys and sets found[i] to 1 and values[i] to the value of keys[i] if it is present,
+   found[i] to 0 and values[i] to 0 if not (add_count can store any value, 0 included); returns how many keys were present */
+int lookup_batch(struct hash_table *t, const int *keys, int n, int *values, uint8_t *found)
+{
+	uint64_t h[LOOKUP_BATCH];
+	int i, j, m, pos, index, count = 0;
+
+	for (i = 0; i < n; i += LOOKUP_BATCH)
+	{
+		rehash_step(t, REHASH_STEP);
+		m = n - i < LOOKUP_BATCH ? n - i : LOOKUP_BATCH;
+
+		for (j = 0; j < m; j++)
+		{
+			h[j] = hash(t, keys[i + j]);
+			pos = (int)(h[j] & (uint64_t)(t->capacity - 1));
+			__builtin_prefetch(t->ctrl + pos);
+			__builtin_prefetch(t->keys + pos);
+		}
+
+		for (j = 0; j < m; j++)
+		{
+			index = probe_hash(t->ctrl, t->keys, t->capacity, keys[i + j], h[j], NULL);
+			if (index >= 0)
+			{
+				values[i + j] = t->values[index];
+				found[i + j] = 1;
+				count++;
+			}
+			else if (t->old_keys != NULL && (index = probe(t, t->old_ctrl, t->old_keys, t->old_capacity, keys[i + j], NULL)) >= 0)
+			{
+				values[i + j] = t->old_values[index];
+				found[i + j] = 1;
+				count++;
+			}
+			else
+			{
+				values[i + j] = 0;
+				found[i + j] = 0;
+			}
+		}
+	}
+
+	return count;
+}
+
+/* Adds count to the value of key, inserting it with that value if it is not present, and prints nothing.
+   Returns 1 if the key was inserted, 0 if it was present already and -1 if there was no room for it. */
+/* The table doubles its capacity when it would be more than 7/8 full. */
+int add_count(struct hash_table *t, int key, int count)
+{
+	int index;
+
+	if (t->map != NULL)
+	{
+		return -1;
+	}
+
+	rehash_step(t, REHASH_STEP);
+
+	if (t->old_keys != NULL && (index = probe(t, t->old_ctrl, t->old_keys, t->old_capacity, key, NULL)) >= 0)
+	{
+		/*  key not moved yet, update it and move it right away  */
+		place(t, key, t->old_values[index] + count);
+		set_ctrl(t->old_ctrl, t->old_capacity, index, DELETED);
+		return 0;
+	}
+
+	index = probe(t, t->ctrl, t->keys, t->capacity, key, NULL);
+	if (index >= 0)
+	{
+		/*  updating already existing key  */
+		t->values[index] += count;
+		return 0;
+	}
+
+	/*  never more than 7/8 full, even when it cannot grow: shift_back and probe need an EMPTY slot to stop at  */
+	if ((long long)(t->size + 1) * 8 > (long long) t->capacity * 7
+	    && (t->capacity >= MAX_CAPACITY || resize(t, 2 * t->capacity) < 0))
+	{
+		return -1;
+	}
+
+	/*  key not present, insert it  */
+	place(t, key, count);
+	t->size++;
+	return 1;
+}
+
+/* to insert a key in the hash table */
+void insert(struct hash_table *t, int key)
+{
+	switch (add_count(t, key, 1))
+	{
+	case 1:
+		printf("\n Key (%d) has been inserted \n", key);
+		break;
+	case 0:
+		printf("\n Key (%d) already present, hence updating its value \n", key);
+		break;
+	default:
 		printf("\n ELEMENT CANNOT BE INSERTED \n");
 	}
 }
  
-/* to remove a key from hash table */
-void remove_element(int key)
+/* Backward-shift deletion: instead of leaving a tombstone, which every later search would have to step over,
+   the keys behind the removed slot are moved back into it as long as that does not put them before
+   their home slot. The run of used slots stays without holes, so an EMPTY slot still ends every search,
+   and probe sequences stay as short as if the removed key had never been inserted. */
+void shift_back(struct hash_table *t, int index)
 {
-	int index  = hashcode(key);
-	if(array[index].value == 0)
-        {
-		printf("\n This key does not exist \n");
+	int mask = t->capacity - 1;
+	int next, home;
+
+	for (next = (index + 1) & mask; t->ctrl[next] & USED; next = (next + 1) & mask)
+	{
+		home = hashcode(t, t->keys[next], t->capacity);
+
+		/*  the key can move back if its home slot is not after the hole  */
+		if (((next - home) & mask) >= ((next - index) & mask))
+		{
+			set_ctrl(t->ctrl, t->capacity, index, t->ctrl[next]);
+			t->keys[index] = t->keys[next];
+			t->values[index] = t->values[next];
+			index = next;
+		}
+	}
+
+	set_ctrl(t->ctrl, t->capacity, index, EMPTY);
+}
+
+/* Shrinks a table which is less than 1/8 full to the smallest capacity at which it is at most 3/8 full,
+   far enough from the 7/8 at which it grows again. A table in the middle of a resize is left alone;
+   rehash_step calls this again when the move is done. */
+void shrink(struct hash_table *t)
+{
+	int cap = MIN_CAPACITY;
+
+	if (t->old_keys != NULL || t->capacity == MIN_CAPACITY || (long long) t->size * 8 >= t->capacity)
+	{
+		return;
+	}
+
+	while ((long long) cap * 3 < (long long) t->size * 8)
+	{
+		cap *= 2;
+	}
+	resize(t, cap);
+}
+
+/* Removes key without printing anything, returns 1 if it was present and 0 if not. */
+/* The old array of a resize is only read and emptied, so there a removed key is just marked DELETED. */
+int remove_key(struct hash_table *t, int key)
+{
+	int index;
+
+	if (t->map != NULL)
+	{
+		return 0;
+	}
+
+	rehash_step(t, REHASH_STEP);
+
+	index = probe(t, t->ctrl, t->keys, t->capacity, key, NULL);
+	if (index >= 0)
+	{
+		shift_back(t, index);
+	}
+	else if (t->old_keys != NULL && (index = probe(t, t->old_ctrl, t->old_keys, t->old_capacity, key, NULL)) >= 0)
+	{
+		set_ctrl(t->old_ctrl, t->old_capacity, index, DELETED);
+	}
+	else
+	{
+		return 0;
 	}
-	else {
-		array[index].key = 0;
-		array[index].value = 0;
-		size--;
+
+	t->size--;
+	shrink(t);
+	return 1;
+}
+
+/* to remove a key from hash table */
+void remove_element(struct hash_table *t, int key)
+{
+	if (remove_key(t, key))
+	{
 		printf("\n Key (%d) has been removed \n", key);
 	}
+	else
+	{
+		printf("\n This key does not exist \n");
+	}
 }
  
 /* to display all the elements of a hash table */
-void display()
+void display(const struct hash_table *t)
 {
 	int i;
-	for (i = 0; i < capacity; i++)
+	for (i = 0; i < t->capacity; i++)
         {
-		if (array[i].value == 0)
+		if (!(t->ctrl[i] & USED))
                 {
-			printf("\n Array[%d] has no elements \n");
+			printf("\n Array[%d] has no elements \n", i);
 		}
 		else 
                 {
-			printf("\n array[%d] has elements -:\n key(%d) and value(%d) \t", i, array[i].key, array[i].value);
+			printf("\n array[%d] has elements -:\n key(%d) and value(%d) \t", i, t->keys[i], t->values[i]);
+		}
+	}
+
+	/*  keys still waiting to be moved by a resize  */
+	for (i = t->rehash_index; t->old_keys != NULL && i < t->old_capacity; i++)
+	{
+		if (t->old_ctrl[i] & USED)
+		{
+			printf("\n old array[%d] has elements -:\n key(%d) and value(%d) \t", i, t->old_keys[i], t->old_values[i]);
 		}
 	}
 }
  
-int size_of_hashtable()
+int size_of_hashtable(const struct hash_table *t)
+{
+	return t->size;
+}
+
+/* sum of the values of all keys; the loop reads the control bytes and the values as two dense arrays
+   and has no branch, so it is vectorized */
+long long sum_values(const struct hash_table *t)
+{
+	long long sum = 0;
+	int i;
+
+	for (i = 0; i < t->capacity; i++)
+	{
+		sum += t->values[i] & -(int)(t->ctrl[i] >> 7);
+	}
+
+	for (i = t->rehash_index; t->old_keys != NULL && i < t->old_capacity; i++)
+	{
+		sum += t->old_values[i] & -(int)(t->old_ctrl[i] >> 7);
+	}
+
+	return sum;
+}
+
+/* Snapshots: a table is saved as one flat file which is mapped back into memory as it is, so a program
+   can query a large table right after start instead of building it again. The file holds this header,
+   then the control bytes, the keys and the values, each at an offset from the start of the file and
+   aligned to a cache line, so the mapping can be at any address. Only the pages a lookup touches are
+   read from disk. The snapshot stores the seed but not the hash function, so it must be opened by a
+   program built with the same HASH_FUNCTION. */
+#define SNAPSHOT_MAGIC "K2HTSNAP"
+#define SNAPSHOT_VERSION 3
+#define SNAPSHOT_BYTE_ORDER 0x01020304
+
+struct snapshot_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint64_t capacity;
+	uint64_t size;
+	uint64_t seed;
+	uint64_t ctrl_offset;
+	uint64_t keys_offset;
+	uint64_t values_offset;
+	uint64_t file_size;
+};
+
+/* to write the table to a snapshot file, returns -1 on error; the file is replaced only once it is complete */
+int save_snapshot(struct hash_table *t, const char *path)
+{
+	static const char zeros[64] = { 0 };
+	struct snapshot_header h;
+	char *tmp;
+	FILE *out;
+	int ok;
+
+	/*  a resize in progress is finished first, so there is a single array to write  */
+	while (t->old_keys != NULL)
+	{
+		rehash_step(t, t->old_capacity);
+	}
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic));
+	h.version = SNAPSHOT_VERSION;
+	h.byte_order = SNAPSHOT_BYTE_ORDER;
+	h.capacity = t->capacity;
+	h.size = t->size;
+	h.seed = t->seed;
+	h.ctrl_offset = (sizeof(h) + 63) & ~(uint64_t) 63;
+	h.keys_offset = (h.ctrl_offset + t->capacity + GROUP_WIDTH - 1 + 63) & ~(uint64_t) 63;
+	h.values_offset = h.keys_offset + (uint64_t) t->capacity * sizeof(int);
+	h.file_size = h.values_offset + (uint64_t) t->capacity * sizeof(int);
+
+	tmp = (char*) malloc(strlen(path) + 5);
+	if (tmp == NULL)
+	{
+		return -1;
+	}
+	sprintf(tmp, "%s.tmp", path);
+
+	out = fopen(tmp, "wb");
+	if (out == NULL)
+	{
+		free(tmp);
+		return -1;
+	}
+
+	ok = fwrite(&h, sizeof(h), 1, out) == 1
+		&& fwrite(zeros, 1, h.ctrl_offset - sizeof(h), out) == h.ctrl_offset - sizeof(h)
+		&& fwrite(t->ctrl, 1, t->capacity + GROUP_WIDTH - 1, out) == (size_t)(t->capacity + GROUP_WIDTH - 1)
+		&& fwrite(zeros, 1, h.keys_offset - h.ctrl_offset - (t->capacity + GROUP_WIDTH - 1), out)
+			== h.keys_offset - h.ctrl_offset - (t->capacity + GROUP_WIDTH - 1)
+		&& fwrite(t->keys, sizeof(int), t->capacity, out) == (size_t) t->capacity
+		&& fwrite(t->values, sizeof(int), t->capacity, out) == (size_t) t->capacity;
+	ok = fclose(out) == 0 && ok && rename(tmp, path) == 0;
+
+	if (!ok)
+	{
+		remove(tmp);
+	}
+	free(tmp);
+	return ok ? 0 : -1;
+}
+
+/* Saves the table from a forked child process, which sees a copy-on-write image of the table as it is now,
+   so the caller can go on changing the table while the file is written. Returns the child's pid, to be
+   passed to waitpid (it exits with 0 on success), or -1 if no process could be started.
+   A resize in progress is finished by the child, in its own copy of the table, so the parent does not pause.
+   The child calls malloc and fopen, which is only safe if the calling process has no other threads. */
+pid_t save_snapshot_async(struct hash_table *t, const char *path)
+{
+	pid_t pid;
+
+	/*  or buffered output would be written twice, once by the child  */
+	fflush(NULL);
+
+	pid = fork();
+	if (pid == 0)
+	{
+		_exit(save_snapshot(t, path) == 0 ? 0 : 1);
+	}
+	return pid;
+}
+
+/* whether len bytes from offset lie within the file, written so that neither side can wrap around */
+int snapshot_fits(const struct snapshot_header *h, uint64_t offset, uint64_t len)
+{
+	return offset <= h->file_size && len <= h->file_size - offset;
+}
+
+/* to open a snapshot file as a read-only table, returns NULL if it cannot be mapped or is not a valid snapshot;
+   lookups work as on any table, insertions fail and removals find nothing */
+struct hash_table *open_snapshot(const char *path)
+{
+	struct hash_table *t;
+	struct snapshot_header h;
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		return NULL;
+	}
+
+	if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(h)
+	    || (map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+	{
+		close(fd);
+		return NULL;
+	}
+	close(fd);
+
+	memcpy(&h, map, sizeof(h));
+	if (memcmp(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic)) != 0 || h.version != SNAPSHOT_VERSION
+	    || h.byte_order != SNAPSHOT_BYTE_ORDER || h.file_size != (uint64_t) st.st_size
+	    || h.capacity < MIN_CAPACITY || h.capacity > MAX_CAPACITY || (h.capacity & (h.capacity - 1)) != 0
+	    || h.size > h.capacity || h.ctrl_offset % 64 != 0 || h.keys_offset % 64 != 0 || h.values_offset % 64 != 0
+	    || h.ctrl_offset < sizeof(h) || !snapshot_fits(&h, h.ctrl_offset, h.capacity + GROUP_WIDTH - 1)
+	    || !snapshot_fits(&h, h.keys_offset, h.capacity * sizeof(int))
+	    || !snapshot_fits(&h, h.values_offset, h.capacity * sizeof(int))
+	    || (t = (struct hash_table*) calloc(1, sizeof(struct hash_table))) == NULL)
+	{
+		munmap(map, st.st_size);
+		return NULL;
+	}
+
+	/*  lookups go to random slots, read-ahead would only load pages nobody asked for  */
+	posix_madvise(map, st.st_size, POSIX_MADV_RANDOM);
+
+	t->ctrl = (uint8_t*) map + h.ctrl_offset;
+	t->keys = (int*)((char*) map + h.keys_offset);
+	t->values = (int*)((char*) map + h.values_offset);
+	t->capacity = (int) h.capacity;
+	t->size = (int) h.size;
+	t->seed = h.seed;
+	t->map = map;
+	t->map_size = st.st_size;
+	return t;
+}
+
+/* A table which any number of threads can use at the same time. Readers take no lock:
+   every slot is one 64 bit word holding the key in the upper half and its count in the lower half,
+   so a reader gets a consistent key and value from a single atomic load and never waits for a writer.
+   Writers lock one of CONCURRENT_STRIPES locks chosen by the key's hash, so two writers of the same key
+   never run at once, while writers of different keys only meet when they claim the same free slot,
+   which they do with compare-and-swap. A key never moves once stored: removing it leaves a DELETED word,
+   which a later insert of any key may take over after checking, under its lock, that its key is not
+   stored further on. So removed slots are reused and inserts keep working however many distinct keys
+   pass through the table. max_probe is the largest distance from its home slot at which a key was ever
+   stored, so a search never looks further, even when DELETED words have replaced all EMPTY ones.
+   The capacity is fixed when the table is created. */
+#define CONCURRENT_EMPTY UINT64_MAX
+#define CONCURRENT_DELETED (UINT64_MAX - 1)
+#define CONCURRENT_STRIPES 64
+
+/* a stripe lock on a cache line of its own, so writers of different stripes do not slow each other down */
+struct concurrent_lock
+{
+	atomic_flag flag;
+	char pad[64 - sizeof(atomic_flag)];
+};
+
+struct concurrent_table
+{
+	_Atomic uint64_t *slots;
+	int capacity;
+	uint64_t seed;
+	atomic_int size;
+	atomic_int max_probe;
+	struct concurrent_lock locks[CONCURRENT_STRIPES];
+};
+
+uint64_t slot_word(int key, int value)
+{
+	return ((uint64_t)(uint32_t) key << 32) | (uint32_t) value;
+}
+
+int slot_key(uint64_t word)
+{
+	return (int)(uint32_t)(word >> 32);
+}
+
+int slot_value(uint64_t word)
+{
+	return (int)(uint32_t) word;
+}
+
+/* EMPTY and DELETED have a count above INT_MAX, which a stored key never has */
+int slot_used(uint64_t word)
+{
+	return word < CONCURRENT_DELETED;
+}
+
+/* to create an empty concurrent table with room for at least capacity keys, returns NULL if out of memory */
+struct concurrent_table *create_concurrent_table(int capacity, uint64_t seed)
+{
+	struct concurrent_table *t = (struct concurrent_table*) malloc(sizeof(struct concurrent_table));
+	int cap = MIN_CAPACITY;
+	int i;
+
+	if (t == NULL)
+	{
+		return NULL;
+	}
+
+	while (cap < capacity && cap < MAX_CAPACITY)
+	{
+		cap *= 2;
+	}
+
+	t->slots = (_Atomic uint64_t*) malloc(cap * sizeof(uint64_t));
+	if (t->slots == NULL)
+	{
+		free(t);
+		return NULL;
+	}
+
+	for (i = 0; i < cap; i++)
+	{
+		atomic_init(&t->slots[i], CONCURRENT_EMPTY);
+	}
+	for (i = 0; i < CONCURRENT_STRIPES; i++)
+	{
+		atomic_flag_clear(&t->locks[i].flag);
+	}
+	t->capacity = cap;
+	t->seed = seed;
+	atomic_init(&t->size, 0);
+	atomic_init(&t->max_probe, 0);
+	return t;
+}
+
+/* must only be called when no other thread uses the table any more */
+void destroy_concurrent_table(struct concurrent_table *t)
+{
+	if (t != NULL)
+	{
+		free((void*) t->slots);
+		free(t);
+	}
+}
+
+/* the stripe is taken from the top bits of the hash, the home slot from the bottom ones */
+struct concurrent_lock *concurrent_lock(struct concurrent_table *t, uint64_t h)
+{
+	struct concurrent_lock *l = &t->locks[h >> 58];
+
+	while (atomic_flag_test_and_set_explicit(&l->flag, memory_order_acquire))
+	{
+	}
+	return l;
+}
+
+void concurrent_unlock(struct concurrent_lock *l)
+{
+	atomic_flag_clear_explicit(&l->flag, memory_order_release);
+}
+
+/* Returns the slot holding key, or -1 if it is not within max_probe slots of its home slot.
+   If free_index is not NULL it gets the first EMPTY or DELETED slot of the probe sequence, or -1. */
+int concurrent_probe(struct concurrent_table *t, int key, uint64_t h, uint64_t *word, int *free_index)
+{
+	int index = (int)(h & (uint64_t)(t->capacity - 1));
+	int limit = atomic_load_explicit(&t->max_probe, memory_order_acquire);
+	int n;
+
+	if (free_index != NULL)
+	{
+		*free_index = -1;
+	}
+
+	for (n = 0; n <= limit; n++, index = (index + 1) & (t->capacity - 1))
+	{
+		*word = atomic_load_explicit(&t->slots[index], memory_order_acquire);
+		if (slot_used(*word))
+		{
+			if (slot_key(*word) == key)
+			{
+				return index;
+			}
+		}
+		else
+		{
+			if (free_index != NULL && *free_index < 0)
+			{
+				*free_index = index;
+			}
+			if (*word == CONCURRENT_EMPTY)
+			{
+				return -1;
+			}
+		}
+	}
+
+	return -1;
+}
+
+/* Stores a new key in the first free slot from start, which other writers may be claiming too.
+   max_probe is raised before the key becomes visible, so a reader which sees the key also searches far enough. */
+int concurrent_claim(struct concurrent_table *t, int key, uint64_t h, int start)
+{
+	int home = (int)(h & (uint64_t)(t->capacity - 1));
+	int index = start < 0 ? home : start;
+	int distance = (index - home) & (t->capacity - 1);
+	int limit;
+	uint64_t word;
+
+	for (; distance < t->capacity; distance++, index = (index + 1) & (t->capacity - 1))
+	{
+		word = atomic_load_explicit(&t->slots[index], memory_order_relaxed);
+		if (slot_used(word))
+		{
+			continue;
+		}
+
+		limit = atomic_load_explicit(&t->max_probe, memory_order_relaxed);
+		while (limit < distance
+		       && !atomic_compare_exchange_weak_explicit(&t->max_probe, &limit, distance,
+								 memory_order_release, memory_order_relaxed))
+		{
+		}
+
+		if (atomic_compare_exchange_strong_explicit(&t->slots[index], &word, slot_word(key, 1),
+							    memory_order_release, memory_order_relaxed))
+		{
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/* to insert a key or increment its count, returns -1 if the table is full */
+int concurrent_insert(struct concurrent_table *t, int key)
+{
+	uint64_t h = HASH_FUNCTION(key, t->seed);
+	struct concurrent_lock *l = concurrent_lock(t, h);
+	uint64_t word;
+	int free_index;
+	int index = concurrent_probe(t, key, h, &word, &free_index);
+	int result = 0;
+
+	/*  only this thread changes the slot of key while it holds the lock  */
+	if (index >= 0)
+	{
+		/*  the count saturates, so it never carries into the key  */
+		if (slot_value(word) < INT_MAX)
+		{
+			atomic_store_explicit(&t->slots[index], word + 1, memory_order_release);
+		}
+	}
+	else if ((result = concurrent_claim(t, key, h, free_index)) == 0)
+	{
+		atomic_fetch_add_explicit(&t->size, 1, memory_order_relaxed);
+	}
+
+	concurrent_unlock(l);
+	return result;
+}
+
+/* to remove a key, returns 0 if it was not present */
+int concurrent_remove(struct concurrent_table *t, int key)
+{
+	uint64_t h = HASH_FUNCTION(key, t->seed);
+	struct concurrent_lock *l = concurrent_lock(t, h);
+	uint64_t word;
+	int index = concurrent_probe(t, key, h, &word, NULL);
+
+	if (index >= 0)
+	{
+		atomic_store_explicit(&t->slots[index], CONCURRENT_DELETED, memory_order_release);
+		atomic_fetch_sub_explicit(&t->size, 1, memory_order_relaxed);
+	}
+
+	concurrent_unlock(l);
+	return index >= 0;
+}
+
+/* to look up a key, returns 1 and its count if it is present; takes no lock and writes nothing */
+int concurrent_lookup(struct concurrent_table *t, int key, int *value)
+{
+	uint64_t word;
+
+	if (concurrent_probe(t, key, HASH_FUNCTION(key, t->seed), &word, NULL) < 0)
+	{
+		return 0;
+	}
+
+	*value = slot_value(word);
+	return 1;
+}
+
+int size_of_concurrent_table(struct concurrent_table *t)
+{
+	return atomic_load_explicit(&t->size, memory_order_relaxed);
+}
+
+/* Cuckoo mode: a table for lookups which must never take long. Every key has two candidate buckets given
+   by two halves of its hash, and is stored in one of them, so a lookup reads at most two buckets, both
+   prefetched at once, whatever the load and the history of the table. A bucket is one cache line with
+   CUCKOO_WAYS keys and their values, and is compared with the key in a few SIMD instructions. Which slots
+   are used is kept in a mask in the same cache line, so a key can have any value, 0 included. If both
+   buckets of a new key are full, a key is kicked out to its other bucket, which may kick out another, up
+   to MAX_KICKS times; a key still without a place then goes to a small stash, which lookups check only
+   when it is not empty. With 7 slots per bucket the table fills to CUCKOO_LOAD before it has to grow;
+   growing rebuilds it in one go, so a table for latency critical lookups should be created with its final
+   capacity. */
+#define CUCKOO_WAYS 7
+#define MAX_KICKS 256
+#define STASH_SIZE 8
+
+/* maximum load in percent */
+#define CUCKOO_LOAD 95
+
+/* 64 bytes: the last key is never used, it pads the keys to two SSE2 registers */
+struct cuckoo_bucket
+{
+	int keys[CUCKOO_WAYS + 1];
+	int values[CUCKOO_WAYS];
+	uint32_t used;
+};
+
+struct cuckoo_table
+{
+	struct cuckoo_bucket *buckets;
+	int mask;
+	int size;
+	uint64_t seed;
+	uint32_t random;
+	int stash_count;
+	struct data stash[STASH_SIZE];
+};
+
+/* Bit i of the result is set when slot i of bucket i holds key. */
+#ifdef __SSE2__
+unsigned int cuckoo_match(const struct cuckoo_table *t, int i, int key)
+{
+	const struct cuckoo_bucket *b = &t->buckets[i];
+	__m128i k = _mm_set1_epi32(key);
+	__m128i lo = _mm_cmpeq_epi32(_mm_load_si128((const __m128i *) b->keys), k);
+	__m128i hi = _mm_cmpeq_epi32(_mm_load_si128((const __m128i *) (b->keys + 4)), k);
+	return (unsigned int) _mm_movemask_epi8(_mm_packs_epi16(_mm_packs_epi32(lo, hi), _mm_setzero_si128()))
+	       & b->used;
+}
+#else
+unsigned int cuckoo_match(const struct cuckoo_table *t, int i, int key)
+{
+	unsigned int mask = 0;
+	int j;
+	for (j = 0; j < CUCKOO_WAYS; j++)
+	{
+		mask |= (unsigned int)(t->buckets[i].keys[j] == key) << j;
+	}
+	return mask & t->buckets[i].used;
+}
+#endif
+
+/* bit i of the result is set when slot i of bucket i is free */
+unsigned int free_slots(const struct cuckoo_table *t, int i)
+{
+	return ~t->buckets[i].used & ((1u << CUCKOO_WAYS) - 1);
+}
+
+/* allocates n empty buckets, returns -1 if out of memory */
+int cuckoo_alloc(struct cuckoo_table *t, int n)
+{
+	t->buckets = (struct cuckoo_bucket*) aligned_alloc(64, n * sizeof(struct cuckoo_bucket));
+	if (t->buckets == NULL)
+	{
+		return -1;
+	}
+
+	memset(t->buckets, 0, n * sizeof(struct cuckoo_bucket));
+	t->mask = n - 1;
+	return 0;
+}
+
+/* the two buckets of a key, always different */
+void cuckoo_buckets(const struct cuckoo_table *t, int key, int *b1, int *b2)
+{
+	uint64_t h = HASH_FUNCTION(key, t->seed);
+
+	*b1 = (int)(h & (uint64_t) t->mask);
+	*b2 = (int)((h >> 32) & (uint64_t) t->mask);
+	if (*b2 == *b1)
+	{
+		*b2 = *b1 ^ 1;
+	}
+}
+
+/* to create an empty cuckoo table with room for at least capacity keys, returns NULL if out of memory */
+struct cuckoo_table *create_cuckoo_table(int capacity, uint64_t seed)
+{
+	struct cuckoo_table *t = (struct cuckoo_table*) calloc(1, sizeof(struct cuckoo_table));
+	int n = 2;
+
+	if (t == NULL)
+	{
+		return NULL;
+	}
+
+	while ((long long) n * CUCKOO_WAYS * CUCKOO_LOAD < (long long) capacity * 100)
+	{
+		n *= 2;
+	}
+
+	if (cuckoo_alloc(t, n) < 0)
+	{
+		free(t);
+		return NULL;
+	}
+
+	t->seed = seed;
+	t->random = 2463534242u;
+	return t;
+}
+
+void destroy_cuckoo_table(struct cuckoo_table *t)
+{
+	if (t != NULL)
+	{
+		free(t->buckets);
+		free(t);
+	}
+}
+
+/* Stores a key which is not in the table, moving other keys between their two buckets if needed.
+   Returns -1 only if the stash was full, and then the key which had no place is lost. */
+int cuckoo_place(struct cuckoo_table *t, int key, int value)
+{
+	struct cuckoo_bucket *b;
+	unsigned int room;
+	int b1, b2, from = -1, target, slot, n, k, v;
+
+	for (n = 0; n <= MAX_KICKS; n++)
+	{
+		cuckoo_buckets(t, key, &b1, &b2);
+
+		if ((room = free_slots(t, b1)) != 0)
+		{
+			target = b1;
+		}
+		else if ((room = free_slots(t, b2)) != 0)
+		{
+			target = b2;
+		}
+		else
+		{
+			/*  both full, kick out a random key, not back to the bucket the current key came from  */
+			t->random ^= t->random << 13;
+			t->random ^= t->random >> 17;
+			t->random ^= t->random << 5;
+
+			target = from == b1 ? b2 : from == b2 ? b1 : (t->random & 1 ? b1 : b2);
+			slot = (t->random >> 1) % CUCKOO_WAYS;
+			b = &t->buckets[target];
+
+			k = b->keys[slot];
+			v = b->values[slot];
+			b->keys[slot] = key;
+			b->values[slot] = value;
+			key = k;
+			value = v;
+			from = target;
+			continue;
+		}
+
+		slot = __builtin_ctz(room);
+		t->buckets[target].keys[slot] = key;
+		t->buckets[target].values[slot] = value;
+		t->buckets[target].used |= 1u << slot;
+		return 0;
+	}
+
+	if (t->stash_count == STASH_SIZE)
+	{
+		return -1;
+	}
+	t->stash[t->stash_count].key = key;
+	t->stash[t->stash_count].value = value;
+	t->stash_count++;
+	return 0;
+}
+
+/* rebuilds the table with at least the given number of buckets, returns -1 if out of memory */
+int cuckoo_rebuild(struct cuckoo_table *t, int nbuckets)
+{
+	struct cuckoo_table n;
+	struct cuckoo_bucket *b;
+	int i, j, ok;
+
+	do
+	{
+		n = *t;
+		n.stash_count = 0;
+		if (cuckoo_alloc(&n, nbuckets) < 0)
+		{
+			return -1;
+		}
+
+		ok = 1;
+		for (i = 0; ok && i <= t->mask; i++)
+		{
+			b = &t->buckets[i];
+			for (j = 0; ok && j < CUCKOO_WAYS; j++)
+			{
+				ok = !(b->used >> j & 1) || cuckoo_place(&n, b->keys[j], b->values[j]) == 0;
+			}
+		}
+		for (i = 0; ok && i < t->stash_count; i++)
+		{
+			ok = cuckoo_place(&n, t->stash[i].key, t->stash[i].value) == 0;
+		}
+
+		/*  very unlikely, but keys did not fit: the old table is intact, try again with more buckets  */
+		if (!ok)
+		{
+			free(n.buckets);
+			nbuckets *= 2;
+		}
+	} while (!ok);
+
+	free(t->buckets);
+	*t = n;
+	return 0;
+}
+
+/* to look up a key, returns 1 and its value if it is present; reads at most two buckets */
+int cuckoo_lookup(const struct cuckoo_table *t, int key, int *value)
+{
+	unsigned int mask;
+	int b1, b2, i;
+
+	cuckoo_buckets(t, key, &b1, &b2);
+	__builtin_prefetch(&t->buckets[b2]);
+
+	if ((mask = cuckoo_match(t, b1, key)) == 0)
+	{
+		b1 = b2;
+		mask = cuckoo_match(t, b1, key);
+	}
+	if (mask != 0)
+	{
+		*value = t->buckets[b1].values[__builtin_ctz(mask)];
+		return 1;
+	}
+
+	for (i = 0; i < t->stash_count; i++)
+	{
+		if (t->stash[i].key == key)
+		{
+			*value = t->stash[i].value;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Adds count to the value of key, inserting it with that value if it is not present.
+   Returns 1 if the key was inserted, 0 if it was present already and -1 if there was no memory to grow. */
+int cuckoo_add(struct cuckoo_table *t, int key, int count)
+{
+	unsigned int mask;
+	int b1, b2, i;
+
+	cuckoo_buckets(t, key, &b1, &b2);
+	for (i = b1; ; i = b2)
+	{
+		if ((mask = cuckoo_match(t, i, key)) != 0)
+		{
+			t->buckets[i].values[__builtin_ctz(mask)] += count;
+			return 0;
+		}
+		if (i == b2)
+		{
+			break;
+		}
+	}
+
+	for (i = 0; i < t->stash_count; i++)
+	{
+		if (t->stash[i].key == key)
+		{
+			t->stash[i].value += count;
+			return 0;
+		}
+	}
+
+	/*  grow until the table is not too full and the stash has room, which a rebuild may have filled
+	    again; cuckoo_place can then always store the key, in the stash if nowhere else  */
+	while ((long long)(t->size + 1) * 100 > (long long)(t->mask + 1) * CUCKOO_WAYS * CUCKOO_LOAD
+	       || t->stash_count == STASH_SIZE)
+	{
+		if (cuckoo_rebuild(t, 2 * (t->mask + 1)) < 0)
+		{
+			return -1;
+		}
+	}
+
+	if (cuckoo_place(t, key, count) < 0)
+	{
+		return -1;
+	}
+	t->size++;
+	return 1;
+}
+
+/* to remove a key, returns 0 if it was not present */
+int cuckoo_remove(struct cuckoo_table *t, int key)
+{
+	unsigned int mask;
+	int b1, b2, i;
+
+	cuckoo_buckets(t, key, &b1, &b2);
+	for (i = b1; ; i = b2)
+	{
+		if ((mask = cuckoo_match(t, i, key)) != 0)
+		{
+			t->buckets[i].used &= ~mask;
+			t->size--;
+			return 1;
+		}
+		if (i == b2)
+		{
+			break;
+		}
+	}
+
+	for (i = 0; i < t->stash_count; i++)
+	{
+		if (t->stash[i].key == key)
+		{
+			t->stash[i] = t->stash[--t->stash_count];
+			t->size--;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int size_of_cuckoo_table(const struct cuckoo_table *t)
+{
+	return t->size;
+}
+
+/* Perfect hashing for a key set which does not change: build_perfect_table maps n keys one to one onto the
+   positions 0 to n-1 of an array of struct data, so a lookup computes the position of its key and reads
+   that one entry, with no probing and no empty slots. It works like PTHash: the keys are split into
+   small buckets, and for every bucket, largest first, a 16 bit pilot is searched which moves all keys
+   of the bucket to positions still free in a range of PERFECT_SLACK percent more than n positions.
+   Positions beyond n are then remapped into the holes below n. The pilots take about 16 bits for every
+   PERFECT_BUCKET_SIZE keys, the remap table is small, and both stay in cache, so a lookup costs one
+   access to the array. The stored key tells a key of the set from any other key. */
+
+/* average number of keys in a bucket is about PERFECT_BUCKET_SIZE / 5 * log2(n) */
+#define PERFECT_BUCKET_SIZE 5
+
+/* extra positions in percent which the pilot search can use */
+#define PERFECT_SLACK 1
+
+/* attempts with a new seed if some bucket finds no pilot */
+#define PERFECT_ATTEMPTS 8
+
+struct perfect_table
+{
+	uint64_t seed;
+	int n;
+	int table_size;
+	int buckets;
+	int dense_buckets;
+	const uint16_t *pilots;
+	const int *remap;
+	const struct data *array;
+};
+
+/* 60% of the keys go to the first 30% of the buckets: large buckets, placed first, find pilots while
+   the table is still empty, which makes the search for the small ones later on much faster */
+int perfect_bucket(const struct perfect_table *t, uint64_t h)
+{
+	uint32_t high = (uint32_t)(h >> 32);
+
+	if ((uint32_t) h < (uint32_t)(0.6 * 4294967296.0))
+	{
+		return (int)(high % (uint32_t) t->dense_buckets);
+	}
+	return t->dense_buckets + (int)(high % (uint32_t)(t->buckets - t->dense_buckets));
+}
+
+/* The multiply spreads every bit of h ^ mix64(pilot) into the top 32 bits, which are then scaled to
+   0 .. table_size - 1 with a multiply and a shift instead of a much slower 64 bit division. */
+int perfect_position(const struct perfect_table *t, uint64_t h, uint16_t pilot)
+{
+	uint64_t x = (h ^ mix64(pilot)) * 0x9E3779B97F4A7C15ULL;
+
+	return (int)(((x >> 32) * (uint64_t)(uint32_t) t->table_size) >> 32);
+}
+
+/* to look up a key, returns 1 and its value if it is one of the keys of the table */
+int perfect_lookup(const struct perfect_table *t, int key, int *value)
+{
+	uint64_t h = HASH_FUNCTION(key, t->seed);
+	int pos;
+
+	if (t->n == 0)
+	{
+		return 0;
+	}
+
+	pos = perfect_position(t, h, t->pilots[perfect_bucket(t, h)]);
+	if (pos >= t->n)
+	{
+		pos = t->remap[pos - t->n];
+	}
+
+	if (t->array[pos].key != key)
+	{
+		return 0;
+	}
+	*value = t->array[pos].value;
+	return 1;
+}
+
+void destroy_perfect_table(struct perfect_table *t)
+{
+	if (t != NULL)
+	{
+		free((void*) t->pilots);
+		free((void*) t->remap);
+		free((void*) t->array);
+		free(t);
+	}
+}
+
+/* One attempt to find the pilots with the seed and sizes set in t. Returns 1 on success, 0 if some bucket
+   found no pilot, and -1 if a bucket holds the same key twice. */
+int perfect_search(const struct perfect_table *t, const uint64_t *h, int n, uint16_t *pilots,
+		   uint8_t *taken, int *order, int *start, int *by_size)
+{
+	int *pos = NULL;
+	int i, j, b, k, size, max_size = 0, result = 1;
+	uint32_t pilot;
+
+	/*  group the keys by bucket: start[b] is where the keys of bucket b begin in order  */
+	memset(start, 0, (t->buckets + 1) * sizeof(int));
+	for (i = 0; i < n; i++)
+	{
+		start[perfect_bucket(t, h[i]) + 1]++;
+	}
+	for (b = 0; b < t->buckets; b++)
+	{
+		if (start[b + 1] > max_size)
+		{
+			max_size = start[b + 1];
+		}
+		start[b + 1] += start[b];
+	}
+	for (i = 0; i < n; i++)
+	{
+		order[start[perfect_bucket(t, h[i])]++] = i;
+	}
+	for (b = t->buckets; b > 0; b--)
+	{
+		start[b] = start[b - 1];
+	}
+	start[0] = 0;
+
+	/*  buckets from largest to smallest, by counting sort on their size  */
+	pos = (int*) calloc(max_size + 2, sizeof(int));
+	if (pos == NULL)
+	{
+		return 0;
+	}
+	for (b = 0; b < t->buckets; b++)
+	{
+		pos[max_size - (start[b + 1] - start[b]) + 1]++;
+	}
+	for (k = 0; k <= max_size; k++)
+	{
+		pos[k + 1] += pos[k];
+	}
+	for (b = 0; b < t->buckets; b++)
+	{
+		by_size[pos[max_size - (start[b + 1] - start[b])]++] = b;
+	}
+	free(pos);
+
+	pos = (int*) malloc((max_size > 0 ? max_size : 1) * sizeof(int));
+	if (pos == NULL)
+	{
+		return 0;
+	}
+
+	memset(taken, 0, t->table_size);
+	for (k = 0; k < t->buckets && result == 1; k++)
+	{
+		b = by_size[k];
+		size = start[b + 1] - start[b];
+		pilots[b] = 0;
+		if (size == 0)
+		{
+			continue;
+		}
+
+		for (i = 0; i < size; i++)
+		{
+			for (j = 0; j < i; j++)
+			{
+				if (h[order[start[b] + i]] == h[order[start[b] + j]])
+				{
+					/*  the hash is a bijection of the key, so this is a duplicate key  */
+					result = -1;
+				}
+			}
+		}
+
+		for (pilot = 0; result == 1 && pilot <= UINT16_MAX; pilot++)
+		{
+			for (i = 0; i < size; i++)
+			{
+				pos[i] = perfect_position(t, h[order[start[b] + i]], (uint16_t) pilot);
+				if (taken[pos[i]])
+				{
+					break;
+				}
+				taken[pos[i]] = 1;
+			}
+			if (i == size)
+			{
+				break;
+			}
+			/*  a collision, with the table or inside the bucket: undo and try the next pilot  */
+			while (i-- > 0)
+			{
+				taken[pos[i]] = 0;
+			}
+		}
+
+		if (result == 1 && pilot > UINT16_MAX)
+		{
+			result = 0;
+		}
+		pilots[b] = (uint16_t) pilot;
+	}
+
+	free(pos);
+	return result;
+}
+
+/* to build a perfect table for the given entries, whose keys must all be different;
+   returns NULL if a key is repeated or if out of memory */
+struct perfect_table *build_perfect_table(const struct data *entries, int n, uint64_t seed)
+{
+	struct perfect_table *t = (struct perfect_table*) calloc(1, sizeof(struct perfect_table));
+	uint64_t *h = NULL;
+	uint16_t *pilots = NULL;
+	uint8_t *taken = NULL;
+	int *order = NULL, *start = NULL, *by_size = NULL, *remap = NULL;
+	struct data *array = NULL;
+	int i, p, log2n, attempt, result = 0;
+
+	if (t == NULL)
+	{
+		return NULL;
+	}
+
+	for (log2n = 1; (1LL << log2n) < n; log2n++)
+		;
+	t->n = n;
+	t->table_size = n + n * PERFECT_SLACK / 100 + 1;
+	t->buckets = (int)((long long) n * PERFECT_BUCKET_SIZE / log2n) + 2;
+	t->dense_buckets = t->buckets * 3 / 10 + 1;
+
+	h = (uint64_t*) malloc((n > 0 ? n : 1) * sizeof(uint64_t));
+	pilots = (uint16_t*) malloc(t->buckets * sizeof(uint16_t));
+	taken = (uint8_t*) malloc(t->table_size);
+	order = (int*) malloc((n > 0 ? n : 1) * sizeof(int));
+	start = (int*) malloc((t->buckets + 1) * sizeof(int));
+	by_size = (int*) malloc(t->buckets * sizeof(int));
+	remap = (int*) malloc((t->table_size - n) * sizeof(int));
+	array = (struct data*) malloc((n > 0 ? n : 1) * sizeof(struct data));
+
+	for (attempt = 0; attempt < PERFECT_ATTEMPTS && result == 0; attempt++)
+	{
+		if (h == NULL || pilots == NULL || taken == NULL || order == NULL || start == NULL
+		    || by_size == NULL || remap == NULL || array == NULL)
+		{
+			break;
+		}
+
+		t->seed = mix64(seed + attempt);
+		for (i = 0; i < n; i++)
+		{
+			h[i] = HASH_FUNCTION(entries[i].key, t->seed);
+		}
+		result = perfect_search(t, h, n, pilots, taken, order, start, by_size);
+	}
+
+	free(order);
+	free(start);
+	free(by_size);
+
+	if (result != 1)
+	{
+		free(h);
+		free(pilots);
+		free(taken);
+		free(remap);
+		free(array);
+		free(t);
+		return NULL;
+	}
+
+	/*  every position taken beyond n gets one of the free positions below n  */
+	for (i = n, p = 0; i < t->table_size; i++)
+	{
+		while (p < n && taken[p])
+		{
+			p++;
+		}
+		remap[i - n] = taken[i] ? p++ : 0;
+	}
+
+	t->pilots = pilots;
+	t->remap = remap;
+	for (i = 0; i < n; i++)
+	{
+		p = perfect_position(t, h[i], pilots[perfect_bucket(t, h[i])]);
+		array[p < n ? p : remap[p - n]] = entries[i];
+	}
+	t->array = array;
+
+	free(h);
+	free(taken);
+	return t;
+}
+
+/* Perfect tables are saved as a header followed by the pilots, the remap table and the entries,
+   and read back into memory in one go; they are small enough for that. */
+#define PERFECT_MAGIC "K2PERFCT"
+#define PERFECT_VERSION 2
+
+struct perfect_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint64_t seed;
+	uint32_t n;
+	uint32_t table_size;
+	uint32_t buckets;
+	uint32_t dense_buckets;
+};
+
+/* to write a perfect table to a file, returns -1 on error */
+int save_perfect_table(const struct perfect_table *t, const char *path)
+{
+	struct perfect_header h;
+	FILE *out = fopen(path, "wb");
+	int ok;
+
+	if (out == NULL)
+	{
+		return -1;
+	}
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, PERFECT_MAGIC, sizeof(h.magic));
+	h.version = PERFECT_VERSION;
+	h.byte_order = SNAPSHOT_BYTE_ORDER;
+	h.seed = t->seed;
+	h.n = t->n;
+	h.table_size = t->table_size;
+	h.buckets = t->buckets;
+	h.dense_buckets = t->dense_buckets;
+
+	ok = fwrite(&h, sizeof(h), 1, out) == 1
+		&& fwrite(t->pilots, sizeof(uint16_t), t->buckets, out) == (size_t) t->buckets
+		&& fwrite(t->remap, sizeof(int), t->table_size - t->n, out) == (size_t)(t->table_size - t->n)
+		&& fwrite(t->array, sizeof(struct data), t->n, out) == (size_t) t->n;
+	ok = fclose(out) == 0 && ok;
+	return ok ? 0 : -1;
+}
+
+/* to read a perfect table from a file, returns NULL if it cannot be read or is not valid */
+struct perfect_table *load_perfect_table(const char *path)
+{
+	struct perfect_header h;
+	struct perfect_table *t;
+	uint16_t *pilots;
+	int *remap;
+	struct data *array;
+	FILE *in = fopen(path, "rb");
+	int ok, i;
+
+	if (in == NULL)
+	{
+		return NULL;
+	}
+
+	if (fread(&h, sizeof(h), 1, in) != 1 || memcmp(h.magic, PERFECT_MAGIC, sizeof(h.magic)) != 0
+	    || h.version != PERFECT_VERSION || h.byte_order != SNAPSHOT_BYTE_ORDER
+	    || h.n > INT_MAX / 2 || h.table_size <= h.n || h.table_size > INT_MAX
+	    || h.buckets < 2 || h.buckets > INT_MAX || h.dense_buckets < 1 || h.dense_buckets >= h.buckets
+	    || (t = (struct perfect_table*) calloc(1, sizeof(struct perfect_table))) == NULL)
+	{
+		fclose(in);
+		return NULL;
+	}
+
+	pilots = (uint16_t*) malloc(h.buckets * sizeof(uint16_t));
+	remap = (int*) malloc((h.table_size - h.n) * sizeof(int));
+	array = (struct data*) malloc((h.n > 0 ? h.n : 1) * sizeof(struct data));
+	t->pilots = pilots;
+	t->remap = remap;
+	t->array = array;
+
+	ok = pilots != NULL && remap != NULL && array != NULL
+		&& fread(pilots, sizeof(uint16_t), h.buckets, in) == h.buckets
+		&& fread(remap, sizeof(int), h.table_size - h.n, in) == h.table_size - h.n
+		&& fread(array, sizeof(struct data), h.n, in) == h.n;
+	fclose(in);
+
+	/*  a remap entry out of range would make lookups read outside the array  */
+	for (i = 0; ok && i < (int)(h.table_size - h.n); i++)
+	{
+		ok = remap[i] >= 0 && (remap[i] < (int) h.n || h.n == 0);
+	}
+
+	if (!ok)
+	{
+		destroy_perfect_table(t);
+		return NULL;
+	}
+
+	t->seed = h.seed;
+	t->n = h.n;
+	t->table_size = h.table_size;
+	t->buckets = h.buckets;
+	t->dense_buckets = h.dense_buckets;
+	return t;
+}
+
+/* Writes a perfect table as C source: a const struct perfect_table called name with its arrays, to be
+   compiled into a program which contains this file, for key sets known when the program is built.
+   C has no constexpr, so the table is built by this program and its result is generated as source. */
+void write_perfect_source(const struct perfect_table *t, FILE *out, const char *name)
+{
+	int i;
+
+	fprintf(out, "/* generated by Exercise3 --perfect, %d keys */\n\n", t->n);
+
+	fprintf(out, "static const uint16_t %s_pilots[%d] = {", name, t->buckets);
+	for (i = 0; i < t->buckets; i++)
+	{
+		fprintf(out, "%s%u,", i % 16 ? " " : "\n\t", t->pilots[i]);
+	}
+	fprintf(out, "\n};\n\n");
+
+	fprintf(out, "static const int %s_remap[%d] = {", name, t->table_size - t->n);
+	for (i = 0; i < t->table_size - t->n; i++)
+	{
+		fprintf(out, "%s%d,", i % 16 ? " " : "\n\t", t->remap[i]);
+	}
+	fprintf(out, "\n};\n\n");
+
+	fprintf(out, "static const struct data %s_array[%d] = {", name, t->n > 0 ? t->n : 1);
+	for (i = 0; i < t->n; i++)
+	{
+		fprintf(out, "%s{%d, %d},", i % 8 ? " " : "\n\t", t->array[i].key, t->array[i].value);
+	}
+	fprintf(out, "%s\n};\n\n", t->n > 0 ? "" : "\n\t{0, 0},");
+
+	fprintf(out, "const struct perfect_table %s = {\n\t0x%016llxULL, %d, %d, %d, %d,\n\t%s_pilots, %s_remap, %s_array\n};\n",
+		name, (unsigned long long) t->seed, t->n, t->table_size, t->buckets, t->dense_buckets, name, name, name);
+}
+
+/* Set mode: a table of keys without values, for membership queries which mostly miss. In front of the
+   table is a blocked Bloom filter: every key sets filter_hashes bits in one 512 bit block, a single cache
+   line, so a key which is not in the set is turned away after reading one cache line in most cases and
+   never reaches the table. The filter is sized by a false positive rate or by a fixed number of bytes.
+   A filter sized by the rate is rebuilt twice as large when the set outgrows the number of keys it was
+   made for. A removed key cannot be cleared from the filter; its bits stay set until the filter is
+   rebuilt, which also happens when the removed keys outnumber the keys in the set. */
+#define BLOCK_BITS 512
+
+/* keys the filter is sized for when it is given a false positive rate and the set is still small */
+#define MIN_FILTER_KEYS 1024
+
+struct hash_set
+{
+	uint8_t *ctrl;
+	int *keys;
+	int capacity;
+	int size;
+	uint64_t seed;
+
+	uint64_t *filter;
+	int filter_blocks;
+	int filter_hashes;
+	int filter_keys;
+	int bits_per_key;
+	size_t filter_bytes;
+	int stale;
+};
+
+/* the filter uses a remix of the hash, so its bits do not depend on the slot and tag bits of the table */
+void filter_add(uint64_t *filter, int blocks, int hashes, uint64_t h)
+{
+	uint64_t g = mix64(h);
+	uint64_t *block = filter + (((g >> 32) * (uint64_t) blocks) >> 32) * (BLOCK_BITS / 64);
+	uint32_t a = (uint32_t) g;
+	uint32_t b = (uint32_t)(mix64(g) >> 32) | 1;
+	int i, bit;
+
+	for (i = 0; i < hashes; i++, a += b)
+	{
+		bit = a % BLOCK_BITS;
+		block[bit / 64] |= (uint64_t) 1 << (bit % 64);
+	}
+}
+
+int filter_test(const uint64_t *filter, int blocks, int hashes, uint64_t h)
+{
+	uint64_t g = mix64(h);
+	const uint64_t *block = filter + (((g >> 32) * (uint64_t) blocks) >> 32) * (BLOCK_BITS / 64);
+	uint32_t a = (uint32_t) g;
+	uint32_t b = (uint32_t)(mix64(g) >> 32) | 1;
+	int i, bit;
+
+	for (i = 0; i < hashes; i++, a += b)
+	{
+		bit = a % BLOCK_BITS;
+		if (!(block[bit / 64] & ((uint64_t) 1 << (bit % 64))))
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* builds the filter again from the keys in the set, sized for the given number of keys;
+   returns -1 if out of memory, and then the old filter is kept, which still holds every key */
+int rebuild_filter(struct hash_set *s, int keys)
+{
+	uint64_t *filter;
+	long long bits;
+	int blocks, i;
+
+	if (keys < MIN_FILTER_KEYS)
+	{
+		keys = MIN_FILTER_KEYS;
+	}
+	bits = s->filter_bytes > 0 ? (long long) s->filter_bytes * 8 : (long long) keys * s->bits_per_key;
+	blocks = (int)((bits + BLOCK_BITS - 1) / BLOCK_BITS);
+	if (blocks < 1)
+	{
+		blocks = 1;
+	}
+
+	filter = (uint64_t*) aligned_alloc(64, (size_t) blocks * (BLOCK_BITS / 8));
+	if (filter == NULL)
+	{
+		return -1;
+	}
+	memset(filter, 0, (size_t) blocks * (BLOCK_BITS / 8));
+
+	for (i = 0; i < s->capacity; i++)
+	{
+		if (s->ctrl[i] & USED)
+		{
+			filter_add(filter, blocks, s->filter_hashes, HASH_FUNCTION(s->keys[i], s->seed));
+		}
+	}
+
+	free(s->filter);
+	s->filter = filter;
+	s->filter_blocks = blocks;
+	s->filter_keys = keys;
+	s->stale = 0;
+	return 0;
+}
+
+/* To create an empty set with room for at least capacity keys. The filter gets filter_bytes bytes,
+   or if filter_bytes is 0, as many bits per key as a false positive rate of fpr needs (with one cache line
+   per key the rate does not go much below 1/1000). Returns NULL if out of memory. */
+struct hash_set *create_hash_set(int capacity, double fpr, size_t filter_bytes, uint64_t seed)
+{
+	struct hash_set *s = (struct hash_set*) calloc(1, sizeof(struct hash_set));
+	double x;
+	int cap = MIN_CAPACITY, log2fpr;
+
+	if (s == NULL)
+	{
+		return NULL;
+	}
+
+	while ((long long) cap * 7 / 8 < capacity && cap < MAX_CAPACITY)
+	{
+		cap *= 2;
+	}
+
+	/*  a Bloom filter needs log2(1/fpr) / ln 2 bits per key; blocking costs more the lower the rate,
+	    as the keys are not spread evenly over the blocks, 25% at 1/16 and 60% at 1/1024  */
+	for (log2fpr = 1, x = 0.5; x > fpr && log2fpr < 32; x /= 2)
+	{
+		log2fpr++;
+	}
+	s->bits_per_key = (log2fpr * 144 * (16 + log2fpr) + 1599) / 1600;
+	s->filter_bytes = filter_bytes;
+
+	/*  ln 2 bits set per key and per bit of filter is the best number of hashes  */
+	s->filter_hashes = filter_bytes > 0 ? (int)((double) filter_bytes * 8 / (capacity > 0 ? capacity : MIN_FILTER_KEYS) * 0.69 + 0.5)
+					    : (s->bits_per_key * 69 + 50) / 100;
+	if (s->filter_hashes < 1)
+	{
+		s->filter_hashes = 1;
+	}
+	if (s->filter_hashes > 16)
+	{
+		s->filter_hashes = 16;
+	}
+
+	s->ctrl = new_ctrl(cap);
+	s->keys = (int*) calloc(cap, sizeof(int));
+	s->capacity = cap;
+	s->seed = seed;
+
+	if (s->ctrl == NULL || s->keys == NULL || rebuild_filter(s, capacity) < 0)
+	{
+		free(s->ctrl);
+		free(s->keys);
+		free(s);
+		return NULL;
+	}
+	return s;
+}
+
+void destroy_hash_set(struct hash_set *s)
+{
+	if (s != NULL)
+	{
+		free(s->ctrl);
+		free(s->keys);
+		free(s->filter);
+		free(s);
+	}
+}
+
+/* stores a key which is known not to be in the set, in the first free slot of its probe sequence */
+void set_place(uint8_t *c, int *k, int cap, int key, uint64_t h)
 {
-	return size;
+	int index;
+
+	probe_hash(c, k, cap, key, h, &index);
+	set_ctrl(c, cap, index, (uint8_t)(USED | h >> 57));
+	k[index] = key;
+}
+
+/* moves the set into arrays of the given capacity, returns -1 if out of memory */
+int set_resize(struct hash_set *s, int new_capacity)
+{
+	uint8_t *c = new_ctrl(new_capacity);
+	int *k = (int*) calloc(new_capacity, sizeof(int));
+	int i;
+
+	if (c == NULL || k == NULL)
+	{
+		free(c);
+		free(k);
+		return -1;
+	}
+
+	for (i = 0; i < s->capacity; i++)
+	{
+		if (s->ctrl[i] & USED)
+		{
+			set_place(c, k, new_capacity, s->keys[i], HASH_FUNCTION(s->keys[i], s->seed));
+		}
+	}
+
+	free(s->ctrl);
+	free(s->keys);
+	s->ctrl = c;
+	s->keys = k;
+	s->capacity = new_capacity;
+	return 0;
+}
+
+/* to check if a key is in the set; most keys which are not are answered by the filter alone */
+int set_contains(const struct hash_set *s, int key)
+{
+	uint64_t h = HASH_FUNCTION(key, s->seed);
+
+	if (!filter_test(s->filter, s->filter_blocks, s->filter_hashes, h))
+	{
+		return 0;
+	}
+	return probe_hash(s->ctrl, s->keys, s->capacity, key, h, NULL) >= 0;
+}
+
+/* to add a key to the set, returns 1 if it was added, 0 if it was there already and -1 if out of memory */
+int set_insert(struct hash_set *s, int key)
+{
+	uint64_t h = HASH_FUNCTION(key, s->seed);
+
+	if (filter_test(s->filter, s->filter_blocks, s->filter_hashes, h)
+	    && probe_hash(s->ctrl, s->keys, s->capacity, key, h, NULL) >= 0)
+	{
+		return 0;
+	}
+
+	/*  never more than 7/8 full, as in add_count, so set_remove always reaches an EMPTY slot  */
+	if ((long long)(s->size + 1) * 8 > (long long) s->capacity * 7
+	    && (s->capacity >= MAX_CAPACITY || set_resize(s, 2 * s->capacity) < 0))
+	{
+		return -1;
+	}
+
+	set_place(s->ctrl, s->keys, s->capacity, key, h);
+	filter_add(s->filter, s->filter_blocks, s->filter_hashes, h);
+	s->size++;
+
+	if (s->filter_bytes == 0 && s->size > s->filter_keys)
+	{
+		rebuild_filter(s, 2 * s->size);
+	}
+	return 1;
+}
+
+/* to remove a key from the set, returns 0 if it was not there; uses backward shift like remove_key */
+int set_remove(struct hash_set *s, int key)
+{
+	uint64_t h = HASH_FUNCTION(key, s->seed);
+	int mask = s->capacity - 1;
+	int index, next, home;
+
+	index = probe_hash(s->ctrl, s->keys, s->capacity, key, h, NULL);
+	if (index < 0)
+	{
+		return 0;
+	}
+
+	for (next = (index + 1) & mask; s->ctrl[next] & USED; next = (next + 1) & mask)
+	{
+		home = (int)(HASH_FUNCTION(s->keys[next], s->seed) & (uint64_t) mask);
+		if (((next - home) & mask) >= ((next - index) & mask))
+		{
+			set_ctrl(s->ctrl, s->capacity, index, s->ctrl[next]);
+			s->keys[index] = s->keys[next];
+			index = next;
+		}
+	}
+	set_ctrl(s->ctrl, s->capacity, index, EMPTY);
+	s->size--;
+
+	/*  the filter still has the bits of removed keys, which make it answer "maybe" more often  */
+	if (++s->stale > s->size && s->stale > MIN_FILTER_KEYS)
+	{
+		rebuild_filter(s, s->filter_keys);
+	}
+	return 1;
+}
+
+int size_of_hash_set(const struct hash_set *s)
+{
+	return s->size;
+}
+
+/* Counting engine: since add_count increments the value of a key which is present already, the table
+   counts how often every key occurs. The input is read in large blocks and parsed in place, and nothing
+   is printed per key, so counting runs at the speed of the table and not of stdio. */
+#define COUNT_BUFFER (1 << 20)
+
+/* counts a number parsed by count_text, returns 1 if it was counted, 0 if it is outside the range of int
+   and was only added to *skipped, and -1 if the table ran out of memory */
+int count_number(struct hash_table *t, uint32_t number, int negative, long long *skipped)
+{
+	if (number > (uint32_t) INT_MAX + (negative ? 1u : 0u))
+	{
+		(*skipped)++;
+		return 0;
+	}
+	return add_count(t, (int)(negative ? 0u - number : number), 1) < 0 ? -1 : 1;
+}
+
+/* counts the integers of a text stream, separated by any characters other than digits and '-';
+   numbers outside the range of int are not counted, their number is stored in *skipped;
+   returns how many integers were counted, or -1 if the table ran out of memory */
+long long count_text(struct hash_table *t, FILE *in, long long *skipped)
+{
+	char *buf = (char*) malloc(COUNT_BUFFER);
+	long long n = 0;
+	uint32_t number = 0;
+	int digits = 0, negative = 0, counted;
+	size_t len, i;
+	unsigned int d;
+
+	*skipped = 0;
+
+	if (buf == NULL)
+	{
+		return -1;
+	}
+
+	while (n >= 0 && (len = fread(buf, 1, COUNT_BUFFER, in)) > 0)
+	{
+		for (i = 0; i < len; i++)
+		{
+			d = (unsigned char) buf[i] - '0';
+			if (d < 10)
+			{
+				/*  too large for an int, whatever comes next: stays at UINT32_MAX instead of wrapping  */
+				number = number > UINT32_MAX / 10 - 1 ? UINT32_MAX : number * 10 + d;
+				digits = 1;
+				continue;
+			}
+
+			/*  a number may continue in the next block, so it is only counted at its end  */
+			if (digits)
+			{
+				if ((counted = count_number(t, number, negative, skipped)) < 0)
+				{
+					n = -1;
+					break;
+				}
+				n += counted;
+			}
+			number = 0;
+			digits = 0;
+			negative = buf[i] == '-';
+		}
+	}
+
+	if (n >= 0 && digits)
+	{
+		n = (counted = count_number(t, number, negative, skipped)) < 0 ? -1 : n + counted;
+	}
+
+	free(buf);
+	return n;
+}
+
+/* counts a stream of 32 bit integers in native byte order, a trailing partial integer is ignored;
+   returns how many integers were read, or -1 if the table ran out of memory */
+long long count_binary(struct hash_table *t, FILE *in)
+{
+	int32_t *buf = (int32_t*) malloc(COUNT_BUFFER);
+	long long n = 0;
+	size_t len, i;
+
+	if (buf == NULL)
+	{
+		return -1;
+	}
+
+	while ((len = fread(buf, sizeof(int32_t), COUNT_BUFFER / sizeof(int32_t), in)) > 0)
+	{
+		for (i = 0; i < len; i++)
+		{
+			if (add_count(t, buf[i], 1) < 0)
+			{
+				free(buf);
+				return -1;
+			}
+		}
+		n += len;
+	}
+
+	free(buf);
+	return n;
+}
+
+/* orders by count, highest first, and keys with the same count in increasing order */
+int compare_counts(const void *a, const void *b)
+{
+	const struct data *x = (const struct data*) a;
+	const struct data *y = (const struct data*) b;
+
+	if (x->value != y->value)
+	{
+		return x->value > y->value ? -1 : 1;
+	}
+	return (x->key > y->key) - (x->key < y->key);
+}
+
+/* keeps the k entries which sort first in a heap whose root is the one that sorts last,
+   so a key which does not make it into the top k costs a single comparison */
+void heap_offer(struct data *heap, int *n, int k, struct data d)
+{
+	int i, child;
+
+	if (*n < k)
+	{
+		/*  sift up  */
+		for (i = (*n)++; i > 0 && compare_counts(&heap[(i - 1) / 2], &d) < 0; i = (i - 1) / 2)
+		{
+			heap[i] = heap[(i - 1) / 2];
+		}
+		heap[i] = d;
+		return;
+	}
+
+	if (k == 0 || compare_counts(&d, &heap[0]) >= 0)
+	{
+		return;
+	}
+
+	/*  replace the root and sift down  */
+	for (i = 0; (child = 2 * i + 1) < k; i = child)
+	{
+		if (child + 1 < k && compare_counts(&heap[child + 1], &heap[child]) > 0)
+		{
+			child++;
+		}
+		if (compare_counts(&heap[child], &d) <= 0)
+		{
+			break;
+		}
+		heap[i] = heap[child];
+	}
+	heap[i] = d;
+}
+
+/* copies the k most frequent keys with their counts into out, sorted, and returns how many there were;
+   with k < 0 all keys are copied, out must have room for min(k, size_of_hashtable(t)) entries */
+int top_counts(const struct hash_table *t, struct data *out, int k)
+{
+	struct data d;
+	int i, n = 0;
+
+	if (k < 0 || k > t->size)
+	{
+		k = t->size;
+	}
+
+	for (i = 0; i < t->capacity; i++)
+	{
+		if (t->ctrl[i] & USED)
+		{
+			d.key = t->keys[i];
+			d.value = t->values[i];
+			heap_offer(out, &n, k, d);
+		}
+	}
+
+	for (i = t->rehash_index; t->old_keys != NULL && i < t->old_capacity; i++)
+	{
+		if (t->old_ctrl[i] & USED)
+		{
+			d.key = t->old_keys[i];
+			d.value = t->old_values[i];
+			heap_offer(out, &n, k, d);
+		}
+	}
+
+	qsort(out, n, sizeof(struct data), compare_counts);
+	return n;
+}
+
+/* counting tool: count [--binary] [--top K] [FILE]
+   prints "key count" lines, most frequent first, and a summary on stderr; reads stdin without FILE or with "-" */
+int count_main(int argc, char *argv[])
+{
+	struct hash_table *table;
+	struct data *counts;
+	FILE *in = stdin;
+	const char *path = "-";
+	int binary = 0, top = -1, i, n;
+	long long total, skipped = 0;
+	double seconds;
+	clock_t start;
+
+	for (i = 0; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--binary") == 0)
+		{
+			binary = 1;
+		}
+		else if (strcmp(argv[i], "--top") == 0 && i + 1 < argc)
+		{
+			top = atoi(argv[++i]);
+		}
+		else
+		{
+			path = argv[i];
+		}
+	}
+
+	if (strcmp(path, "-") != 0 && (in = fopen(path, binary ? "rb" : "r")) == NULL)
+	{
+		fprintf(stderr, "cannot open %s\n", path);
+		return 1;
+	}
+
+	table = create_table(MIN_CAPACITY, (uint64_t) time(NULL));
+	if (table == NULL)
+	{
+		fprintf(stderr, "Not enough memory for the Hash Table\n");
+		return 1;
+	}
+
+	start = clock();
+	total = binary ? count_binary(table, in) : count_text(table, in, &skipped);
+	seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+	if (in != stdin)
+	{
+		fclose(in);
+	}
+
+	if (total < 0)
+	{
+		fprintf(stderr, "Not enough memory for the Hash Table\n");
+		destroy_table(table);
+		return 1;
+	}
+
+	n = top >= 0 && top < table->size ? top : table->size;
+	counts = (struct data*) malloc((n > 0 ? n : 1) * sizeof(struct data));
+	if (counts == NULL)
+	{
+		fprintf(stderr, "Not enough memory for the Hash Table\n");
+		destroy_table(table);
+		return 1;
+	}
+
+	n = top_counts(table, counts, top);
+	for (i = 0; i < n; i++)
+	{
+		printf("%d %d\n", counts[i].key, counts[i].value);
+	}
+
+	fprintf(stderr, "%lld integers, %d distinct keys, %.3f s, %.1f M integers/s\n",
+		total, table->size, seconds, seconds > 0 ? total / seconds / 1e6 : 0.0);
+	if (skipped > 0)
+	{
+		fprintf(stderr, "%lld numbers outside the range of int skipped\n", skipped);
+	}
+
+	free(counts);
+	destroy_table(table);
+	return 0;
+}
+
+/* seed of the perfect hash tool, fixed so that the same input always gives the same table */
+#define PERFECT_SEED 0x5DEECE66DULL
+
+/* perfect hash tool: perfect [--binary] [--seed SEED] [--save FILE | --source NAME] [INPUT]
+   counts the integers of INPUT like count, then builds a perfect table of the keys with their counts
+   and writes it to FILE, or as C source called NAME to stdout */
+int perfect_main(int argc, char *argv[])
+{
+	struct hash_table *table;
+	struct perfect_table *perfect;
+	struct data *entries;
+	FILE *in = stdin;
+	const char *path = "-", *save = NULL, *source = NULL;
+	uint64_t seed = PERFECT_SEED;
+	long long skipped = 0;
+	int binary = 0, i, n;
+	clock_t start;
+
+	for (i = 0; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--binary") == 0)
+		{
+			binary = 1;
+		}
+		else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+		{
+			seed = strtoull(argv[++i], NULL, 0);
+		}
+		else if (strcmp(argv[i], "--save") == 0 && i + 1 < argc)
+		{
+			save = argv[++i];
+		}
+		else if (strcmp(argv[i], "--source") == 0 && i + 1 < argc)
+		{
+			source = argv[++i];
+		}
+		else
+		{
+			path = argv[i];
+		}
+	}
+
+	if (strcmp(path, "-") != 0 && (in = fopen(path, binary ? "rb" : "r")) == NULL)
+	{
+		fprintf(stderr, "cannot open %s\n", path);
+		return 1;
+	}
+
+	table = create_table(MIN_CAPACITY, 0);
+	if (table == NULL || (binary ? count_binary(table, in) : count_text(table, in, &skipped)) < 0)
+	{
+		fprintf(stderr, "Not enough memory for the Hash Table\n");
+		destroy_table(table);
+		return 1;
+	}
+	if (in != stdin)
+	{
+		fclose(in);
+	}
+	if (skipped > 0)
+	{
+		fprintf(stderr, "%lld numbers outside the range of int skipped\n", skipped);
+	}
+
+	n = size_of_hashtable(table);
+	entries = (struct data*) malloc((n > 0 ? n : 1) * sizeof(struct data));
+	if (entries == NULL)
+	{
+		fprintf(stderr, "Not enough memory for the Hash Table\n");
+		destroy_table(table);
+		return 1;
+	}
+	n = top_counts(table, entries, -1);
+	destroy_table(table);
+
+	start = clock();
+	perfect = build_perfect_table(entries, n, seed);
+	free(entries);
+	if (perfect == NULL)
+	{
+		fprintf(stderr, "cannot build the perfect table\n");
+		return 1;
+	}
+
+	fprintf(stderr, "%d keys, %.2f bits per key besides the entries, built in %.3f s\n", n,
+		n > 0 ? (16.0 * perfect->buckets + 32.0 * (perfect->table_size - n)) / n : 0.0,
+		(double)(clock() - start) / CLOCKS_PER_SEC);
+
+	if (source != NULL)
+	{
+		write_perfect_source(perfect, stdout, source);
+	}
+	if (save != NULL && save_perfect_table(perfect, save) != 0)
+	{
+		fprintf(stderr, "cannot save %s\n", save);
+		destroy_perfect_table(perfect);
+		return 1;
+	}
+
+	destroy_perfect_table(perfect);
+	return 0;
+}
+
+/* Batch driver: runs a script of operations, one per line, so the table can be exercised with millions of
+   operations in a reproducible way. The operations are
+	i KEY	insert KEY (or increment its value)
+	r KEY	remove KEY
+	l KEY	look up KEY, prints "KEY VALUE" or "KEY -"
+	s	print the number of keys
+   Empty lines and lines starting with '#' are skipped. Output goes through a large stdout buffer,
+   and --quiet suppresses it, so only the summary on stderr is left.
+   --load FILE runs the script on a snapshot (read-only) instead of an empty table, --save FILE writes one at the end. */
+int batch_main(int argc, char *argv[])
+{
+	static char out_buffer[1 << 16];
+	struct hash_table *table;
+	FILE *in = stdin;
+	const char *path = "-", *load = NULL, *save = NULL;
+	char line[64], *p;
+	int quiet = 0, i, c, key, value;
+	long long ops = 0, misses = 0, lineno = 0;
+	double seconds;
+	clock_t start;
+
+	for (i = 0; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--quiet") == 0)
+		{
+			quiet = 1;
+		}
+		else if (strcmp(argv[i], "--load") == 0 && i + 1 < argc)
+		{
+			load = argv[++i];
+		}
+		else if (strcmp(argv[i], "--save") == 0 && i + 1 < argc)
+		{
+			save = argv[++i];
+		}
+		else
+		{
+			path = argv[i];
+		}
+	}
+
+	if (strcmp(path, "-") != 0 && (in = fopen(path, "r")) == NULL)
+	{
+		fprintf(stderr, "cannot open %s\n", path);
+		return 1;
+	}
+
+	if (load != NULL)
+	{
+		table = open_snapshot(load);
+		if (table == NULL)
+		{
+			fprintf(stderr, "cannot open snapshot %s\n", load);
+			return 1;
+		}
+	}
+	else if ((table = create_table(MIN_CAPACITY, 0)) == NULL)
+	{
+		fprintf(stderr, "Not enough memory for the Hash Table\n");
+		return 1;
+	}
+
+	setvbuf(stdout, out_buffer, _IOFBF, sizeof(out_buffer));
+	start = clock();
+
+	while (fgets(line, sizeof(line), in) != NULL)
+	{
+		lineno++;
+
+		/*  a line longer than the buffer, e.g. a long comment: its start is enough, the rest is skipped  */
+		if (strchr(line, '\n') == NULL)
+		{
+			while ((c = getc(in)) != EOF && c != '\n')
+				;
+		}
+
+		for (p = line; *p == ' ' || *p == '\t'; p++)
+			;
+		if (*p == '\0' || *p == '\n' || *p == '\r' || *p == '#')
+		{
+			continue;
+		}
+
+		if (*p != 's' && sscanf(p + 1, "%d", &key) != 1)
+		{
+			fprintf(stderr, "line %lld: missing key\n", lineno);
+			continue;
+		}
+
+		switch (*p)
+		{
+		case 'i':
+			if (add_count(table, key, 1) < 0)
+			{
+				fprintf(stderr, "line %lld: ELEMENT CANNOT BE INSERTED\n", lineno);
+			}
+			break;
+
+		case 'r':
+			misses += !remove_key(table, key);
+			break;
+
+		case 'l':
+			if (lookup(table, key, &value))
+			{
+				if (!quiet)
+				{
+					printf("%d %d\n", key, value);
+				}
+			}
+			else
+			{
+				misses++;
+				if (!quiet)
+				{
+					printf("%d -\n", key);
+				}
+			}
+			break;
+
+		case 's':
+			if (!quiet)
+			{
+				printf("%d\n", size_of_hashtable(table));
+			}
+			break;
+
+		default:
+			fprintf(stderr, "line %lld: unknown operation '%c'\n", lineno, *p);
+			continue;
+		}
+		ops++;
+	}
+
+	fflush(stdout);
+	seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+	if (in != stdin)
+	{
+		fclose(in);
+	}
+
+	fprintf(stderr, "%lld operations (%lld missed keys), %d keys left, %.3f s, %.1f M ops/s\n",
+		ops, misses, size_of_hashtable(table), seconds, seconds > 0 ? ops / seconds / 1e6 : 0.0);
+
+	if (save != NULL && save_snapshot(table, save) != 0)
+	{
+		fprintf(stderr, "cannot save snapshot %s\n", save);
+		destroy_table(table);
+		return 1;
+	}
+
+	destroy_table(table);
+	return 0;
 }
  
-void main()
+int main(int argc, char *argv[])
 {
 	int choice, key, value, n, c;
-	clrscr();
+	struct hash_table *table;
+
+	if (argc > 1 && strcmp(argv[1], "--count") == 0)
+	{
+		return count_main(argc - 2, argv + 2);
+	}
+
+	if (argc > 1 && strcmp(argv[1], "--batch") == 0)
+	{
+		return batch_main(argc - 2, argv + 2);
+	}
+
+	if (argc > 1 && strcmp(argv[1], "--perfect") == 0)
+	{
+		return perfect_main(argc - 2, argv + 2);
+	}
  
-	init_array();
+	table = create_table(MIN_CAPACITY, 0);
+	if (table == NULL)
+	{
+		printf("\n Not enough memory for the Hash Table \n");
+		return 1;
+	}
  
 	do {
 		printf("\n Implementation of Hash Table in C \n\n");
@@ -135,6 +2690,7 @@ void main()
                                "\n2.Removing item from the Hash Table"
 		               "\n3.Check the size of Hash Table" 
                                "\n4.Display a Hash Table"
+		               "\n5.Looking up item in the Hash Table"
 		       "\n\n Please enter your choice -:");
  
 		scanf("%d", &choice);
@@ -147,7 +2703,7 @@ void main()
 		      printf("Inserting element in Hash Table\n");
 		      printf("Enter key -:\t");
 		      scanf("%d", &key);
-		      insert(key);
+		      insert(table, key);
  
 		      break;
  
@@ -155,22 +2711,37 @@ void main()
  
 		      printf("Deleting in Hash Table \n Enter the key to delete-:");
 		      scanf("%d", &key);
-		      remove_element(key);
+		      remove_element(table, key);
  
 		      break;
  
 		case 3:
  
-		      n = size_of_hashtable();
+		      n = size_of_hashtable(table);
 		      printf("Size of Hash Table is-:%d\n", n);
  
 		      break;
  
 		case 4:
  
-		      display();
+		      display(table);
  
 		      break;
+
+		case 5:
+
+		      printf("Looking up in Hash Table \n Enter the key to look up-:");
+		      scanf("%d", &key);
+		      if (lookup(table, key, &value))
+		      {
+			      printf("\n Key (%d) has value (%d) \n", key, value);
+		      }
+		      else
+		      {
+			      printf("\n This key does not exist \n");
+		      }
+
+		      break;
  
 		default:
  
@@ -183,6 +2754,6 @@ void main()
  
 	}while(c == 1);
  
-	getch();
- 
+	destroy_table(table);
+	return 0;
 }